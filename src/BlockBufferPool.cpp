@@ -0,0 +1,161 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "BlockBufferPool.h"
+
+namespace dg { namespace osn {
+
+using std::lock_guard;
+using std::mutex;
+
+BlockBufferPool::BlockBufferPool(const cv::Size& blockSize, size_t capacity, const cv::MatAllocator* fallback) :
+    blockSize_(blockSize),
+    capacity_(capacity),
+    fallback_(fallback)
+{
+    free_.reserve(capacity_);
+}
+
+BlockBufferPool::~BlockBufferPool()
+{
+    for(auto buffer : free_) {
+        fallback_->deallocate(buffer);
+    }
+}
+
+cv::UMatData* BlockBufferPool::allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+                                        cv::UMatUsageFlags usageFlags) const
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for(int i = dims - 1; i >= 0; --i) {
+        total *= sizes[i];
+    }
+
+    // Pooled buffers come from the fallback allocator too, wrapped so they come back here when released
+    cv::UMatData* buffer = nullptr;
+    if(!data && matches(dims, sizes, total)) {
+        lock_guard<mutex> lock(mutex_);
+        // The first allocation sets the buffer size. A later image of the same block geometry may have other bands
+        // or depth, its buffers replace the old ones once those are all back.
+        if(total != bufferSize_ && free_.size() == allocated_) {
+            for(auto free : free_) {
+                fallback_->deallocate(free);
+            }
+            free_.clear();
+            allocated_ = 0;
+            bufferSize_ = total;
+        }
+
+        if(total == bufferSize_) {
+            if(!free_.empty()) {
+                buffer = free_.back();
+                free_.pop_back();
+                ++hits_;
+            } else if(allocated_ < capacity_) {
+                size_t bufferStep[2];
+                buffer = fallback_->allocate(dims, sizes, type, nullptr, bufferStep, flags, usageFlags);
+                CV_Assert(buffer && bufferStep[0] == sizes[1] * bufferStep[1]);
+                ++allocated_;
+                ++misses_;
+            } else {
+                ++misses_;
+            }
+        }
+    }
+
+    if(!buffer) {
+        return fallback_->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    if(step) {
+        size_t elemTotal = CV_ELEM_SIZE(type);
+        for(int i = dims - 1; i >= 0; --i) {
+            step[i] = elemTotal;
+            elemTotal *= sizes[i];
+        }
+    }
+
+    auto u = new cv::UMatData(this);
+    u->data = u->origdata = buffer->data;
+    u->size = total;
+    u->userdata = buffer;
+    return u;
+}
+
+bool BlockBufferPool::allocate(cv::UMatData* data, int, cv::UMatUsageFlags) const
+{
+    return data != nullptr;
+}
+
+void BlockBufferPool::deallocate(cv::UMatData* data) const
+{
+    if(!data) {
+        return;
+    }
+
+    CV_Assert(data->urefcount == 0);
+    CV_Assert(data->refcount == 0);
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        free_.push_back(static_cast<cv::UMatData*>(data->userdata));
+    }
+
+    data->origdata = nullptr;
+    delete data;
+}
+
+cv::Mat BlockBufferPool::newMat() const
+{
+    cv::Mat mat;
+    mat.allocator = const_cast<BlockBufferPool*>(this);
+    return mat;
+}
+
+const cv::Size& BlockBufferPool::blockSize() const
+{
+    return blockSize_;
+}
+
+size_t BlockBufferPool::hits() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return hits_;
+}
+
+size_t BlockBufferPool::misses() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return misses_;
+}
+
+bool BlockBufferPool::matches(int dims, const int* sizes, size_t total) const
+{
+    return dims == 2 && sizes[0] == blockSize_.height && sizes[1] == blockSize_.width && total > 0;
+}
+
+ScopedDefaultAllocator::ScopedDefaultAllocator(cv::MatAllocator* allocator) :
+    previous_(cv::Mat::getDefaultAllocator())
+{
+    cv::Mat::setDefaultAllocator(allocator);
+}
+
+ScopedDefaultAllocator::~ScopedDefaultAllocator()
+{
+    cv::Mat::setDefaultAllocator(previous_);
+}
+
+} } // namespace dg { namespace osn {
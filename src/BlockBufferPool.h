@@ -0,0 +1,84 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_BLOCKBUFFERPOOL_H
+#define OPENSPACENET_BLOCKBUFFERPOOL_H
+
+#include <opencv2/core/core.hpp>
+#include <mutex>
+#include <vector>
+
+namespace dg { namespace osn {
+
+//
+// OpenCV allocator that recycles a fixed number of block-sized buffers. Only the cv::Mat objects obtained from newMat()
+// use it, and of their allocations only those with exactly the block geometry come from the pool. Everything else, as
+// well as requests past the pool capacity, goes to the fallback allocator. The pooled buffers themselves are allocated
+// by the fallback too, which must return continuous buffers. Buffers go back to the pool when the last cv::Mat
+// referencing them is released.
+//
+// The pool must outlive every cv::Mat it allocated.
+//
+class BlockBufferPool : public cv::MatAllocator
+{
+public:
+    BlockBufferPool(const cv::Size& blockSize, size_t capacity,
+                    const cv::MatAllocator* fallback = cv::Mat::getStdAllocator());
+    ~BlockBufferPool();
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+                           cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, int accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    // An empty cv::Mat allocating from the pool, i.e. with create() or as the destination of copyTo()
+    cv::Mat newMat() const;
+
+    const cv::Size& blockSize() const;
+    size_t hits() const;
+    size_t misses() const;
+
+private:
+    bool matches(int dims, const int* sizes, size_t total) const;
+
+    const cv::Size blockSize_;
+    const size_t capacity_;
+    const cv::MatAllocator* fallback_;
+
+    mutable std::mutex mutex_;
+    mutable size_t bufferSize_ = 0;
+    mutable size_t allocated_ = 0;
+    mutable std::vector<cv::UMatData*> free_;
+    mutable size_t hits_ = 0;
+    mutable size_t misses_ = 0;
+};
+
+//
+// Makes an allocator the cv::Mat default for the lifetime of the object.
+//
+class ScopedDefaultAllocator
+{
+public:
+    explicit ScopedDefaultAllocator(cv::MatAllocator* allocator);
+    ~ScopedDefaultAllocator();
+
+private:
+    cv::MatAllocator* previous_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_BLOCKBUFFERPOOL_H
@@ -0,0 +1,261 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "BlockFetcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <utility/Error.h>
+#include <vector>
+
+namespace dg { namespace osn {
+
+using dg::deepcore::imagery::GeoImage;
+using std::async;
+using std::atomic;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::future;
+using std::launch;
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+using std::unique_ptr;
+using std::vector;
+
+static vector<unique_ptr<GeoImage>> openImages(const BlockFetcher::ImageFactory& openImage, int count)
+{
+    vector<unique_ptr<GeoImage>> images;
+    for(int i = 0; i < count; ++i) {
+        images.push_back(openImage());
+        DG_CHECK(images.back(), "Error opening the image");
+        DG_CHECK(images.back()->size() == images.front()->size() &&
+                 images.back()->blockSize() == images.front()->blockSize(), "Images opened for reading differ");
+    }
+    return images;
+}
+
+BlockFetcher::BlockFetcher(const ImageFactory& openImage, int maxConnections, size_t cacheBytes, seconds cacheTtl,
+                           RateLimiter* limiter) :
+    images_(openImages(openImage, max(1, maxConnections))),
+    maxConnections_((int) images_.size()),
+    cacheBytes_(cacheBytes),
+    cacheTtl_(cacheTtl),
+    blockSize_(images_.front()->blockSize()),
+    imageRect_({ 0, 0 }, images_.front()->size()),
+    limiter_(limiter)
+{
+}
+
+cv::Mat BlockFetcher::read(const cv::Rect& rect, const ProgressFunc& progress)
+{
+    DG_CHECK((rect & imageRect_) == rect, "Requested region is outside of the image");
+
+    auto origins = blocksIn(rect);
+    cv::Mat result;
+    mutex resultMutex;
+    size_t done = 0;
+    atomic<bool> cancelled(false);
+    forEach(origins.size(), [&](GeoImage& image, size_t i) {
+        auto blockRect = cv::Rect(origins[i], blockSize_) & imageRect_;
+        auto overlap = rect & blockRect;
+        auto block = fetch(image, origins[i], overlap != blockRect, cancelled);
+        DG_CHECK(block.size() == blockRect.size(), "Unexpected block size");
+
+        {
+            lock_guard<mutex> lock(resultMutex);
+            if(result.empty()) {
+                result.create(rect.size(), block.type());
+            }
+        }
+
+        // Blocks don't overlap, so the copies can run unlocked
+        block(overlap - blockRect.tl()).copyTo(result(overlap - rect.tl()));
+
+        bool proceed;
+        {
+            lock_guard<mutex> lock(resultMutex);
+            proceed = progress((float) ++done / origins.size());
+        }
+        if(!proceed) {
+            cancelled.store(true);
+            DG_ERROR_THROW("Reading was cancelled");
+        }
+        return true;
+    });
+
+    return result;
+}
+
+bool BlockFetcher::readBlocks(const BlockFunc& func)
+{
+    auto origins = blocksIn(imageRect_);
+    atomic<bool> cancelled(false);
+    return forEach(origins.size(), [&](GeoImage& image, size_t i) {
+        auto block = fetch(image, origins[i], false, cancelled);
+        if(!func(origins[i], std::move(block))) {
+            cancelled.store(true);
+            return false;
+        }
+        return true;
+    });
+}
+
+size_t BlockFetcher::cacheHits() const
+{
+    lock_guard<mutex> lock(cacheMutex_);
+    return cacheHits_;
+}
+
+vector<cv::Point> BlockFetcher::blocksIn(const cv::Rect& rect) const
+{
+    vector<cv::Point> origins;
+    for(int y = rect.y / blockSize_.height * blockSize_.height; y < rect.br().y; y += blockSize_.height) {
+        for(int x = rect.x / blockSize_.width * blockSize_.width; x < rect.br().x; x += blockSize_.width) {
+            origins.emplace_back(x, y);
+        }
+    }
+    return origins;
+}
+
+bool BlockFetcher::forEach(size_t count, const std::function<bool(GeoImage& image, size_t i)>& func)
+{
+    std::exception_ptr error;
+    mutex errorMutex;
+    atomic<size_t> next(0);
+    atomic<bool> stop(false);
+
+    auto worker = [&](GeoImage& image) {
+        try {
+            size_t i;
+            while(!stop.load() && (i = next++) < count) {
+                if(!func(image, i)) {
+                    stop.store(true);
+                }
+            }
+        } catch(...) {
+            lock_guard<mutex> lock(errorMutex);
+            if(!error) {
+                error = std::current_exception();
+            }
+            stop.store(true);
+        }
+    };
+
+    vector<future<void>> workers;
+    auto numWorkers = min((size_t) maxConnections_, count);
+    for(size_t i = 1; i < numWorkers; ++i) {
+        workers.push_back(async(launch::async, worker, std::ref(*images_[i])));
+    }
+    worker(*images_.front());
+
+    for(auto& w : workers) {
+        w.wait();
+    }
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+
+    return !stop.load();
+}
+
+cv::Mat BlockFetcher::fetch(GeoImage& image, const cv::Point& origin, bool partial, const atomic<bool>& cancelled)
+{
+    Key key(origin.x, origin.y);
+
+    cv::Mat block;
+    if(cached(key, block)) {
+        return block;
+    }
+
+    if(limiter_) {
+        limiter_->acquire();
+    }
+
+    auto blockRect = cv::Rect(origin, blockSize_) & imageRect_;
+    block = GeoImage::readImage(image, blockRect, [&cancelled](float) -> bool {
+        return !cancelled.load();
+    });
+
+    // The compressed size of a server tile isn't visible from here, so the decoded size is charged instead
+    if(limiter_) {
+        limiter_->consume(block.total() * block.elemSize());
+    }
+
+    // Only blocks the neighboring regions still need are worth keeping
+    if(partial) {
+        cache(key, block);
+    }
+
+    return block;
+}
+
+bool BlockFetcher::cached(const Key& key, cv::Mat& block)
+{
+    lock_guard<mutex> lock(cacheMutex_);
+    auto it = cache_.find(key);
+    if(it == cache_.end()) {
+        return false;
+    }
+
+    if(it->second.expiry < steady_clock::now()) {
+        cachedBytes_ -= it->second.block.total() * it->second.block.elemSize();
+        lru_.erase(it->second.lru);
+        cache_.erase(it);
+        return false;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    block = it->second.block;
+    ++cacheHits_;
+    return true;
+}
+
+void BlockFetcher::cache(const Key& key, const cv::Mat& block)
+{
+    auto bytes = block.total() * block.elemSize();
+    if(bytes > cacheBytes_) {
+        return;
+    }
+
+    lock_guard<mutex> lock(cacheMutex_);
+    if(cache_.count(key)) {
+        return;
+    }
+
+    lru_.push_front(key);
+    cache_[key] = { block, steady_clock::now() + cacheTtl_, lru_.begin() };
+    cachedBytes_ += bytes;
+
+    // Evict least recently used entries past the budget, along with expired ones found on the way
+    auto now = steady_clock::now();
+    while(!lru_.empty()) {
+        auto it = cache_.find(lru_.back());
+        if(cachedBytes_ <= cacheBytes_ && it->second.expiry >= now) {
+            break;
+        }
+
+        cachedBytes_ -= it->second.block.total() * it->second.block.elemSize();
+        cache_.erase(it);
+        lru_.pop_back();
+    }
+}
+
+} } // namespace dg { namespace osn {
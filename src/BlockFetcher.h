@@ -0,0 +1,102 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_BLOCKFETCHER_H
+#define OPENSPACENET_BLOCKFETCHER_H
+
+#include "RateLimiter.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <imagery/GeoImage.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <utility>
+#include <vector>
+
+namespace dg { namespace osn {
+
+//
+// Reads regions of a web service image one native block (server tile) at a time. Blocks only partly covered by a
+// region are kept for a short while, since the neighboring region usually needs them next. Regions are read one
+// after another, the blocks of a region are distinct, so no two downloads of the same block overlap.
+//
+// GeoImage reads aren't known to be reentrant, so every download thread reads from an image of its own. All of them
+// are opened up front with openImage, which must return images of the same area.
+//
+class BlockFetcher
+{
+public:
+    typedef std::function<bool(float progress)> ProgressFunc;
+    typedef std::function<bool(const cv::Point& origin, cv::Mat&& block)> BlockFunc;
+    typedef std::function<std::unique_ptr<deepcore::imagery::GeoImage>()> ImageFactory;
+
+    // Every block download passes through limiter, if there is one
+    BlockFetcher(const ImageFactory& openImage, int maxConnections, size_t cacheBytes, std::chrono::seconds cacheTtl,
+                 RateLimiter* limiter = nullptr);
+
+    // Reads rect, in image pixels, from up to maxConnections blocks at a time. Same contract as GeoImage::readImage(),
+    // progress is called as blocks complete and the read throws if it returns false.
+    cv::Mat read(const cv::Rect& rect, const ProgressFunc& progress);
+
+    // Reads every block of the image, up to maxConnections at a time, and passes each one to func as it arrives,
+    // possibly from several threads at once. Returns false if func stopped it.
+    bool readBlocks(const BlockFunc& func);
+
+    // Blocks served from the cache
+    size_t cacheHits() const;
+
+private:
+    typedef std::pair<int, int> Key;
+
+    struct CacheEntry
+    {
+        cv::Mat block;
+        std::chrono::steady_clock::time_point expiry;
+        std::list<Key>::iterator lru;
+    };
+
+    std::vector<cv::Point> blocksIn(const cv::Rect& rect) const;
+
+    // Calls func for 0 to count - 1 on up to maxConnections threads, each with its own image, until it returns false
+    // or throws
+    bool forEach(size_t count, const std::function<bool(deepcore::imagery::GeoImage& image, size_t i)>& func);
+    cv::Mat fetch(deepcore::imagery::GeoImage& image, const cv::Point& origin, bool partial,
+                  const std::atomic<bool>& cancelled);
+    bool cached(const Key& key, cv::Mat& block);
+    void cache(const Key& key, const cv::Mat& block);
+
+    std::vector<std::unique_ptr<deepcore::imagery::GeoImage>> images_;
+    const int maxConnections_;
+    const size_t cacheBytes_;
+    const std::chrono::seconds cacheTtl_;
+    const cv::Size blockSize_;
+    const cv::Rect imageRect_;
+    RateLimiter* limiter_;
+
+    mutable std::mutex cacheMutex_;
+    std::map<Key, CacheEntry> cache_;
+    std::list<Key> lru_;
+    size_t cachedBytes_ = 0;
+    size_t cacheHits_ = 0;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_BLOCKFETCHER_H
@@ -0,0 +1,203 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "BlockQueue.h"
+#include "OpenSpaceNetLog.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <fstream>
+#include <iterator>
+#include <opencv2/imgcodecs.hpp>
+#include <utility/Error.h>
+#include <vector>
+
+namespace dg { namespace osn {
+
+using boost::filesystem::create_directories;
+using boost::filesystem::path;
+using boost::filesystem::remove;
+using boost::filesystem::remove_all;
+using boost::filesystem::temp_directory_path;
+using boost::filesystem::unique_path;
+using boost::format;
+using std::chrono::milliseconds;
+using std::ifstream;
+using std::lock_guard;
+using std::mutex;
+using std::ofstream;
+using std::string;
+using std::unique_lock;
+
+// PNG with the fastest zlib setting is lossless and cheap to encode for the types it supports
+static bool pngEncodable(const cv::Mat& block)
+{
+    return (block.depth() == CV_8U || block.depth() == CV_16U) &&
+           (block.channels() == 1 || block.channels() == 3 || block.channels() == 4);
+}
+
+static size_t blockBytes(const cv::Mat& block)
+{
+    return block.total() * block.elemSize();
+}
+
+BlockQueue::BlockQueue(size_t memoryLimit, const string& scratchPath, const BlockBufferPool* pool) :
+    memoryLimit_(memoryLimit),
+    scratchPath_(scratchPath.empty() ? temp_directory_path().string() : scratchPath),
+    pool_(pool)
+{
+}
+
+BlockQueue::~BlockQueue()
+{
+    if(!spillDir_.empty()) {
+        boost::system::error_code ec;
+        remove_all(spillDir_, ec);
+    }
+}
+
+void BlockQueue::push(const cv::Point& origin, cv::Mat&& block)
+{
+    Entry entry { origin, cv::Mat(), string() };
+    auto bytes = blockBytes(block);
+
+    bool spillBlock;
+    {
+        lock_guard<mutex> lock(mutex_);
+        spillBlock = memoryLimit_ && memoryUsed_ + bytes > memoryLimit_ && !queue_.empty();
+        if(!spillBlock) {
+            memoryUsed_ += bytes;
+        }
+    }
+
+    if(spillBlock) {
+        entry.path = spill(block);
+        block.release();
+    } else {
+        entry.block = std::move(block);
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        queue_.push_back(std::move(entry));
+    }
+
+    haveBlock_.notify_one();
+}
+
+bool BlockQueue::pop(cv::Point& origin, cv::Mat& block, milliseconds timeout)
+{
+    Entry entry;
+    {
+        unique_lock<mutex> lock(mutex_);
+        if(queue_.empty()) {
+            haveBlock_.wait_for(lock, timeout);
+            if(queue_.empty()) {
+                return false;
+            }
+        }
+
+        entry = std::move(queue_.front());
+        queue_.pop_front();
+        memoryUsed_ -= blockBytes(entry.block);
+    }
+
+    origin = entry.origin;
+    if(entry.path.empty()) {
+        block = std::move(entry.block);
+    } else {
+        block = reload(entry.path);
+        remove(entry.path);
+    }
+
+    return true;
+}
+
+void BlockQueue::notify()
+{
+    haveBlock_.notify_all();
+}
+
+size_t BlockQueue::size() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return queue_.size();
+}
+
+size_t BlockQueue::spilled() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return spillCount_;
+}
+
+string BlockQueue::spill(const cv::Mat& block)
+{
+    size_t id;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if(spillDir_.empty()) {
+            spillDir_ = (path(scratchPath_) / unique_path("osn-blocks-%%%%-%%%%-%%%%")).string();
+            create_directories(spillDir_);
+            OSN_LOG(info) << "Block queue exceeded " << (memoryLimit_ >> 20) << " MB, spilling blocks to " << spillDir_;
+        }
+        id = spillCount_++;
+    }
+
+    if(pngEncodable(block)) {
+        auto filePath = (format("%s/%d.png") % spillDir_ % id).str();
+        DG_CHECK(cv::imwrite(filePath, block, { cv::IMWRITE_PNG_COMPRESSION, 1 }), "Error writing %s", filePath.c_str());
+        return filePath;
+    }
+
+    // Anything PNG can't hold is written raw, prefixed with its geometry
+    auto filePath = (format("%s/%d.raw") % spillDir_ % id).str();
+    ofstream ofs(filePath, std::ios::binary);
+    DG_CHECK(!ofs.fail(), "Error opening %s for writing", filePath.c_str());
+
+    int header[] = { block.rows, block.cols, block.type() };
+    ofs.write((const char*) header, sizeof(header));
+    for(int row = 0; row < block.rows; ++row) {
+        ofs.write((const char*) block.ptr(row), block.cols * block.elemSize());
+    }
+    DG_CHECK(!ofs.fail(), "Error writing %s", filePath.c_str());
+
+    return filePath;
+}
+
+cv::Mat BlockQueue::reload(const string& filePath) const
+{
+    auto block = pool_ ? pool_->newMat() : cv::Mat();
+    ifstream ifs(filePath, std::ios::binary);
+    DG_CHECK(!ifs.fail(), "Error opening %s", filePath.c_str());
+
+    if(path(filePath).extension() == ".png") {
+        // imread can't decode into a given buffer, imdecode can
+        std::vector<uchar> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        cv::imdecode(data, cv::IMREAD_UNCHANGED, &block);
+        DG_CHECK(!block.empty(), "Error reading %s", filePath.c_str());
+        return block;
+    }
+
+    int header[3];
+    ifs.read((char*) header, sizeof(header));
+    block.create(header[0], header[1], header[2]);
+    ifs.read((char*) block.data, block.total() * block.elemSize());
+    DG_CHECK(!ifs.fail(), "Error reading %s", filePath.c_str());
+
+    return block;
+}
+
+} } // namespace dg { namespace osn {
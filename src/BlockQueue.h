@@ -0,0 +1,76 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_BLOCKQUEUE_H
+#define OPENSPACENET_BLOCKQUEUE_H
+
+#include "BlockBufferPool.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <string>
+
+namespace dg { namespace osn {
+
+//
+// Thread-safe FIFO queue of image blocks. Once the blocks held in memory exceed the memory limit, new blocks are
+// compressed and spilled to a scratch directory, and read back in order when they reach the front of the queue.
+//
+class BlockQueue
+{
+public:
+    // A memory limit of 0 means the queue is never spilled. Spilled blocks are read back into buffers from pool, if
+    // there is one.
+    BlockQueue(size_t memoryLimit, const std::string& scratchPath, const BlockBufferPool* pool = nullptr);
+    ~BlockQueue();
+
+    void push(const cv::Point& origin, cv::Mat&& block);
+
+    // Waits for a block for up to timeout, returns false if there was none
+    bool pop(cv::Point& origin, cv::Mat& block, std::chrono::milliseconds timeout);
+
+    void notify();
+    size_t size() const;
+    size_t spilled() const;
+
+private:
+    struct Entry
+    {
+        cv::Point origin;
+        cv::Mat block;
+        std::string path;
+    };
+
+    std::string spill(const cv::Mat& block);
+    cv::Mat reload(const std::string& path) const;
+
+    const size_t memoryLimit_;
+    const std::string scratchPath_;
+    const BlockBufferPool* pool_;
+    std::string spillDir_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable haveBlock_;
+    std::deque<Entry> queue_;
+    size_t memoryUsed_ = 0;
+    size_t spillCount_ = 0;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_BLOCKQUEUE_H
@@ -0,0 +1,116 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_BOUNDEDQUEUE_H
+#define OPENSPACENET_BOUNDEDQUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace dg { namespace osn {
+
+//
+// Fixed-capacity FIFO handing items from one thread to another. Both sides block while the queue is full or empty,
+// and the time they spent blocked is recorded so the caller can tell which side is the bottleneck. Once closed,
+// push() discards its item and pop() drains what is left.
+//
+template<class T>
+class BoundedQueue
+{
+public:
+    typedef std::chrono::duration<double> Duration;
+
+    explicit BoundedQueue(size_t capacity) :
+        capacity_(capacity)
+    {
+    }
+
+    // Returns false if the queue was closed
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(!closed_ && items_.size() >= capacity_) {
+            auto start = std::chrono::steady_clock::now();
+            notFull_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+            pushWait_ += std::chrono::steady_clock::now() - start;
+        }
+
+        if(closed_) {
+            return false;
+        }
+
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(!closed_ && items_.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            notEmpty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+            popWait_ += std::chrono::steady_clock::now() - start;
+        }
+
+        if(items_.empty()) {
+            return false;
+        }
+
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+
+    Duration pushWait() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pushWait_;
+    }
+
+    Duration popWait() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return popWait_;
+    }
+
+private:
+    const size_t capacity_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    Duration pushWait_ { 0 };
+    Duration popWait_ { 0 };
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_BOUNDEDQUEUE_H
@@ -0,0 +1,82 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "ClassPrediction.h"
+#include "OpenSpaceNetLog.h"
+
+#include <limits>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using std::numeric_limits;
+using std::string;
+using std::vector;
+
+LabelTable::LabelTable(const vector<string>& labels) :
+    labels_(labels)
+{
+    DG_CHECK(labels_.size() <= numeric_limits<ClassId>::max(), "Too many model labels: %d", (int) labels_.size());
+
+    ids_.reserve(labels_.size());
+    for(size_t i = 0; i < labels_.size(); ++i) {
+        ids_.emplace(labels_[i], (ClassId) i);
+    }
+}
+
+ClassId LabelTable::id(const string& label) const
+{
+    auto it = ids_.find(label);
+    DG_CHECK(it != ids_.end(), "Unknown label: %s", label.c_str());
+    return it->second;
+}
+
+const string& LabelTable::label(ClassId id) const
+{
+    return labels_[id];
+}
+
+size_t LabelTable::size() const
+{
+    return labels_.size();
+}
+
+vector<bool> LabelTable::classFilter(const vector<string>& includeLabels, const vector<string>& excludeLabels) const
+{
+    vector<bool> keep(labels_.size(), includeLabels.empty());
+
+    for(const auto& label : includeLabels) {
+        auto it = ids_.find(label);
+        if(it != ids_.end()) {
+            keep[it->second] = true;
+        } else {
+            OSN_LOG(warning) << "Label " << label << " is not in the model.";
+        }
+    }
+
+    for(const auto& label : excludeLabels) {
+        auto it = ids_.find(label);
+        if(it != ids_.end()) {
+            keep[it->second] = false;
+        } else {
+            OSN_LOG(warning) << "Label " << label << " is not in the model.";
+        }
+    }
+
+    return keep;
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,60 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_CLASSPREDICTION_H
+#define OPENSPACENET_CLASSPREDICTION_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dg { namespace osn {
+
+typedef uint16_t ClassId;
+
+struct ClassScore
+{
+    ClassId classId;
+    float score;
+};
+
+//
+// Maps the model labels to compact class ids. Built once per model, labels are only looked up again when the
+// output is written.
+//
+class LabelTable
+{
+public:
+    LabelTable() = default;
+    explicit LabelTable(const std::vector<std::string>& labels);
+
+    ClassId id(const std::string& label) const;
+    const std::string& label(ClassId id) const;
+    size_t size() const;
+
+    // Returns a flag per class id which is set for the classes that pass the include/exclude lists
+    std::vector<bool> classFilter(const std::vector<std::string>& includeLabels,
+                                  const std::vector<std::string>& excludeLabels) const;
+
+private:
+    std::vector<std::string> labels_;
+    std::unordered_map<std::string, ClassId> ids_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_CLASSPREDICTION_H
@@ -0,0 +1,73 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "FeatureSchema.h"
+
+#include <algorithm>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using namespace dg::deepcore::vector;
+
+using std::string;
+
+FeatureSchema::FeatureSchema(const FieldDefinitions& definitions) :
+    definitions_(definitions)
+{
+    for(const auto& definition : definitions_) {
+        names_.push_back(definition.name);
+    }
+}
+
+const FieldDefinitions& FeatureSchema::definitions() const
+{
+    return definitions_;
+}
+
+size_t FeatureSchema::index(const string& name) const
+{
+    auto it = std::find(names_.begin(), names_.end(), name);
+    DG_CHECK(it != names_.end(), "Unknown output field: %s", name.c_str());
+    return it - names_.begin();
+}
+
+void FeatureSchema::set(size_t index, const Field& value)
+{
+    auto it = fields_.find(names_[index]);
+    if(it != fields_.end()) {
+        it->second = value;
+    } else {
+        fields_.emplace(names_[index], value);
+    }
+}
+
+void FeatureSchema::set(size_t index, Field&& value)
+{
+    auto it = fields_.find(names_[index]);
+    if(it != fields_.end()) {
+        it->second = std::move(value);
+    } else {
+        fields_.emplace(names_[index], std::move(value));
+    }
+}
+
+const Fields& FeatureSchema::fields() const
+{
+    return fields_;
+}
+
+} } // namespace dg { namespace osn {
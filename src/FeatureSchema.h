@@ -0,0 +1,55 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_FEATURESCHEMA_H
+#define OPENSPACENET_FEATURESCHEMA_H
+
+#include <string>
+#include <vector>
+#include <vector/Feature.h>
+
+namespace dg { namespace osn {
+
+//
+// The output attribute layout, built once from the field definitions. Values are set by field index into one Fields
+// map that is kept for the whole run, a value whose field is already in the map is assigned in place. Values stay set
+// until overwritten, so constant values (i.e. producer info) are only set once. Features still get their own copy of
+// the map.
+//
+class FeatureSchema
+{
+public:
+    FeatureSchema() = default;
+    explicit FeatureSchema(const deepcore::vector::FieldDefinitions& definitions);
+
+    const deepcore::vector::FieldDefinitions& definitions() const;
+    size_t index(const std::string& name) const;
+
+    void set(size_t index, const deepcore::vector::Field& value);
+    void set(size_t index, deepcore::vector::Field&& value);
+
+    // The fields with the current values
+    const deepcore::vector::Fields& fields() const;
+
+private:
+    deepcore::vector::FieldDefinitions definitions_;
+    std::vector<std::string> names_;
+    deepcore::vector::Fields fields_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_FEATURESCHEMA_H
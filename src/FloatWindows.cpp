@@ -0,0 +1,54 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "FloatWindows.h"
+
+namespace dg { namespace osn {
+
+FloatWindows::FloatWindows(const cv::Mat& image, int tileSize, const cv::Size& maxWindow) :
+    image_(image),
+    tileSize_(tileSize),
+    maxWindow_(maxWindow)
+{
+}
+
+cv::Mat FloatWindows::window(const cv::Rect& rect, const cv::Mat& windowImage)
+{
+    cv::Mat converted;
+    if(windowImage.size() != rect.size() || rect.width > maxWindow_.width || rect.height > maxWindow_.height) {
+        windowImage.convertTo(converted, CV_32F);
+        return converted;
+    }
+
+    auto column = rect.x / tileSize_;
+    auto row = rect.y / tileSize_;
+    if(row != row_) {
+        tiles_.clear();
+        row_ = row;
+    }
+
+    cv::Rect tileRect(column * tileSize_, row * tileSize_, tileSize_ + maxWindow_.width, tileSize_ + maxWindow_.height);
+    tileRect &= cv::Rect({ 0, 0 }, image_.size());
+
+    auto& tile = tiles_[column];
+    if(tile.empty()) {
+        image_(tileRect).convertTo(tile, CV_32F);
+    }
+
+    return tile(rect - tileRect.tl());
+}
+
+} } // namespace dg { namespace osn {
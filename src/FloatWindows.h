@@ -0,0 +1,52 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_FLOATWINDOWS_H
+#define OPENSPACENET_FLOATWINDOWS_H
+
+#include <map>
+#include <opencv2/core/core.hpp>
+
+namespace dg { namespace osn {
+
+//
+// Hands out the windows of an image as float views, converting each tile of the image once so overlapping windows
+// share the conversion instead of the model converting every window. A window belongs to the tile its top left
+// corner is in, tiles extend by the window size past their grid cell so their windows fit. Windows are expected in
+// row-major order, the tiles of the previous row are released when a new row starts. Batches still waiting for the
+// model keep their tiles alive.
+//
+class FloatWindows
+{
+public:
+    FloatWindows(const cv::Mat& image, int tileSize, const cv::Size& maxWindow);
+
+    // The window at rect, in image pixels. Windows the slicer resized aren't views of the image, those are converted
+    // on their own.
+    cv::Mat window(const cv::Rect& rect, const cv::Mat& windowImage);
+
+private:
+    const cv::Mat image_;
+    const int tileSize_;
+    const cv::Size maxWindow_;
+
+    int row_ = -1;
+    std::map<int, cv::Mat> tiles_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_FLOATWINDOWS_H
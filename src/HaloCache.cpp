@@ -0,0 +1,134 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "HaloCache.h"
+
+#include <algorithm>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using std::max;
+
+HaloCache::HaloCache(int width, int tileSize) :
+    width_(width),
+    tileSize_(tileSize)
+{
+}
+
+cv::Mat HaloCache::read(const cv::Rect& extent, const ReadFunc& readFunc)
+{
+    if(extent.y != row_) {
+        // Starting a new row of tiles, the bottom halo of the previous row is its top band
+        if(!nextBand_.empty() && nextBandRect_.y == extent.y) {
+            band_ = nextBand_;
+            bandRect_ = nextBandRect_;
+        } else {
+            band_.release();
+            bandRect_ = cv::Rect();
+        }
+
+        nextBand_.release();
+        nextBandRect_ = cv::Rect();
+        strip_.release();
+        stripRect_ = cv::Rect();
+        row_ = extent.y;
+    }
+
+    // Only whole top rows and whole left columns of the extent are taken from the cache, the rest is read
+    auto fresh = extent;
+    auto bandPart = extent & bandRect_;
+    if(bandPart.area() && bandPart.tl() == extent.tl() && bandPart.width == extent.width) {
+        fresh.y += bandPart.height;
+        fresh.height -= bandPart.height;
+    } else {
+        bandPart = cv::Rect();
+    }
+
+    auto stripPart = extent & stripRect_;
+    if(stripPart.area() && stripPart.tl() == extent.tl() && stripPart.height == extent.height) {
+        fresh.x += stripPart.width;
+        fresh.width -= stripPart.width;
+    } else {
+        stripPart = cv::Rect();
+    }
+
+    cv::Mat freshImage;
+    if(fresh.width > 0 && fresh.height > 0) {
+        freshImage = readFunc(fresh);
+        DG_CHECK(freshImage.size() == fresh.size(), "Read %dx%d pixels for a %dx%d region",
+                 freshImage.cols, freshImage.rows, fresh.width, fresh.height);
+    }
+
+    cv::Mat tile;
+    if(!bandPart.area() && !stripPart.area()) {
+        tile = freshImage;
+    } else {
+        auto type = !freshImage.empty() ? freshImage.type() : (bandPart.area() ? band_.type() : strip_.type());
+        tile.create(extent.size(), type);
+
+        if(bandPart.area()) {
+            band_(bandPart - bandRect_.tl()).copyTo(tile(bandPart - extent.tl()));
+        }
+        if(stripPart.area()) {
+            strip_(stripPart - stripRect_.tl()).copyTo(tile(stripPart - extent.tl()));
+        }
+        if(!freshImage.empty()) {
+            freshImage.copyTo(tile(fresh - extent.tl()));
+        }
+
+        reused_ += (size_t) (bandPart.area() + stripPart.area() - (bandPart & stripPart).area());
+    }
+
+    keep(tile, extent);
+    return tile;
+}
+
+size_t HaloCache::reused() const
+{
+    return reused_;
+}
+
+void HaloCache::keep(const cv::Mat& tile, const cv::Rect& extent)
+{
+    // The columns past the tile are the left strip of the next tile in the row
+    cv::Rect strip(extent.x + tileSize_, extent.y, extent.br().x - (extent.x + tileSize_), extent.height);
+    if(strip.width > 0) {
+        strip_ = tile(strip - extent.tl()).clone();
+        stripRect_ = strip;
+    } else {
+        strip_.release();
+        stripRect_ = cv::Rect();
+    }
+
+    // The rows past the tile are the top band of the next row, collected across the whole row
+    cv::Rect bottom(extent.x, extent.y + tileSize_, extent.width, extent.br().y - (extent.y + tileSize_));
+    if(bottom.height <= 0) {
+        return;
+    }
+
+    if(nextBand_.empty()) {
+        nextBand_.create(bottom.height, width_, tile.type());
+        nextBandRect_ = cv::Rect(0, bottom.y, 0, bottom.height);
+    }
+
+    if(bottom.y == nextBandRect_.y && bottom.height == nextBandRect_.height) {
+        tile(bottom - extent.tl()).copyTo(nextBand_(bottom - nextBandRect_.tl()));
+        nextBandRect_.width = max(nextBandRect_.width, bottom.br().x);
+    }
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,61 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_HALOCACHE_H
+#define OPENSPACENET_HALOCACHE_H
+
+#include <functional>
+#include <opencv2/core/core.hpp>
+
+namespace dg { namespace osn {
+
+//
+// Keeps the halo of tiles read in row-major order, so overlapping tile extents are only read once. The right strip
+// of the last tile is reused by the next tile in the row, and the bottom halo of the whole row by the next row. Both
+// are dropped as soon as the processing order moves past them.
+//
+class HaloCache
+{
+public:
+    typedef std::function<cv::Mat(const cv::Rect& rect)> ReadFunc;
+
+    HaloCache(int width, int tileSize);
+
+    // Assembles the extent from the cached halos and whatever read returns for the rest
+    cv::Mat read(const cv::Rect& extent, const ReadFunc& readFunc);
+
+    // Pixels served from the cache so far
+    size_t reused() const;
+
+private:
+    void keep(const cv::Mat& tile, const cv::Rect& extent);
+
+    const int width_;
+    const int tileSize_;
+
+    cv::Mat strip_;
+    cv::Rect stripRect_;
+    cv::Mat band_;
+    cv::Rect bandRect_;
+    cv::Mat nextBand_;
+    cv::Rect nextBandRect_;
+    int row_ = -1;
+    size_t reused_ = 0;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_HALOCACHE_H
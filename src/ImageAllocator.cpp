@@ -0,0 +1,114 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "ImageAllocator.h"
+
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+namespace dg { namespace osn {
+
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+void* allocateImageBuffer(size_t size)
+{
+    if(size < HUGE_PAGE_THRESHOLD) {
+        return cv::fastMalloc(size);
+    }
+
+    // Rounding up to whole huge pages keeps the tail of the buffer from sharing a page with anything else
+    auto alignedSize = cv::alignSize(size, (int) HUGE_PAGE_SIZE);
+
+    void* buffer = nullptr;
+    if(posix_memalign(&buffer, HUGE_PAGE_SIZE, alignedSize)) {
+        throw std::bad_alloc();
+    }
+
+#ifdef MADV_HUGEPAGE
+    // Only advisory, if transparent huge pages are disabled we simply get regular pages
+    madvise(buffer, alignedSize, MADV_HUGEPAGE);
+#endif
+
+    return buffer;
+}
+
+void freeImageBuffer(void* buffer, size_t size)
+{
+    if(size < HUGE_PAGE_THRESHOLD) {
+        cv::fastFree(buffer);
+    } else {
+        free(buffer);
+    }
+}
+
+ImageAllocator* ImageAllocator::get()
+{
+    static ImageAllocator allocator;
+    return &allocator;
+}
+
+ImageAllocator::ImageAllocator() :
+    stdAllocator_(cv::Mat::getStdAllocator())
+{
+}
+
+cv::UMatData* ImageAllocator::allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+                                       cv::UMatUsageFlags usageFlags) const
+{
+    size_t total = CV_ELEM_SIZE(type);
+    for(int i = dims - 1; i >= 0; --i) {
+        total *= sizes[i];
+    }
+
+    if(data || total < HUGE_PAGE_THRESHOLD) {
+        return stdAllocator_->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    if(step) {
+        size_t elemTotal = CV_ELEM_SIZE(type);
+        for(int i = dims - 1; i >= 0; --i) {
+            step[i] = elemTotal;
+            elemTotal *= sizes[i];
+        }
+    }
+
+    auto u = new cv::UMatData(this);
+    u->data = u->origdata = (uchar*) allocateImageBuffer(total);
+    u->size = total;
+    return u;
+}
+
+bool ImageAllocator::allocate(cv::UMatData* data, int, cv::UMatUsageFlags) const
+{
+    return data != nullptr;
+}
+
+void ImageAllocator::deallocate(cv::UMatData* data) const
+{
+    if(!data) {
+        return;
+    }
+
+    CV_Assert(data->urefcount == 0);
+    CV_Assert(data->refcount == 0);
+
+    freeImageBuffer(data->origdata, data->size);
+    data->origdata = nullptr;
+    delete data;
+}
+
+} } // namespace dg { namespace osn {
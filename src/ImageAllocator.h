@@ -0,0 +1,53 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_IMAGEALLOCATOR_H
+#define OPENSPACENET_IMAGEALLOCATOR_H
+
+#include <opencv2/core/core.hpp>
+
+namespace dg { namespace osn {
+
+// Buffers of at least this size are 2 MB aligned and backed by transparent huge pages where available
+const size_t HUGE_PAGE_THRESHOLD = 8 << 20;
+
+void* allocateImageBuffer(size_t size);
+void freeImageBuffer(void* buffer, size_t size);
+
+//
+// OpenCV allocator for imagery. Large buffers come from allocateImageBuffer(), so traversing a multi-gigabyte image
+// touches far fewer TLB entries, everything else goes to the standard allocator. The allocator is stateless and
+// lives for the duration of the process.
+//
+class ImageAllocator : public cv::MatAllocator
+{
+public:
+    static ImageAllocator* get();
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+                           cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, int accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+private:
+    ImageAllocator();
+
+    const cv::MatAllocator* stdAllocator_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_IMAGEALLOCATOR_H
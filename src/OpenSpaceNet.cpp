@@ -16,8 +16,19 @@
 ********************************************************************************/
 
 #include "OpenSpaceNet.h"
+#include "BlockFetcher.h"
+#include "BlockQueue.h"
+#include "BoundedQueue.h"
+#include "FloatWindows.h"
+#include "HaloCache.h"
+#include "ImageAllocator.h"
+#include "PredictionSpill.h"
+#include "SaliencyMap.h"
+#include "SuperBlockReader.h"
+#include "TileCache.h"
 #include <OpenSpaceNetVersion.h>
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <boost/range/combine.hpp>
 #include <boost/date_time.hpp>
@@ -27,9 +38,13 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/range/algorithm/copy.hpp>
 #include <classification/GbdxModelReader.h>
-#include <classification/NonMaxSuppression.h>
-#include <classification/FilterLabels.h>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <fstream>
 #include <future>
+#include <cpl_conv.h>
+#include <gdal.h>
 #include <geometry/AffineTransformation.h>
 #include <geometry/CvToLog.h>
 #include <imagery/GdalImage.h>
@@ -37,9 +52,10 @@
 #include <imagery/SlidingWindowSlicer.h>
 #include <imagery/DgcsClient.h>
 #include <imagery/EvwhsClient.h>
+#include <iomanip>
+#include <ogr_srs_api.h>
 #include <geometry/TransformationChain.h>
 #include <utility/MultiProgressDisplay.h>
-#include <utility/Semaphore.h>
 #include <utility/User.h>
 
 namespace dg { namespace osn {
@@ -64,6 +80,10 @@ using std::async;
 using std::back_inserter;
 using std::chrono::duration;
 using std::chrono::high_resolution_clock;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::condition_variable;
 using std::cout;
 using std::deque;
 using std::endl;
@@ -72,17 +92,147 @@ using std::lock_guard;
 using std::make_pair;
 using std::map;
 using std::move;
-using std::recursive_mutex;
+using std::mutex;
+using std::ofstream;
 using std::ostringstream;
 using std::pair;
 using std::string;
 using std::vector;
+using std::unique_lock;
 using std::unique_ptr;
 using dg::deepcore::almostEq;
 using dg::deepcore::loginUser;
-using dg::deepcore::Semaphore;
 using dg::deepcore::MultiProgressDisplay;
 
+static atomic<int> receivedSignal = ATOMIC_VAR_INIT(0);
+
+static void onSignal(int signum)
+{
+    // A second signal while we are draining means the user wants out now
+    if(receivedSignal.exchange(signum)) {
+        std::signal(signum, SIG_DFL);
+        std::raise(signum);
+    }
+}
+
+// Installs the stop handlers for its lifetime, the previous handlers come back even if processing throws
+class StopSignals
+{
+public:
+    StopSignals() :
+        prevSigInt_(std::signal(SIGINT, onSignal)),
+        prevSigTerm_(std::signal(SIGTERM, onSignal))
+    {
+    }
+
+    ~StopSignals()
+    {
+        std::signal(SIGINT, prevSigInt_);
+        std::signal(SIGTERM, prevSigTerm_);
+    }
+
+private:
+    void (*prevSigInt_)(int);
+    void (*prevSigTerm_)(int);
+};
+
+// Batches prepared ahead of the model in serial mode
+static const size_t BATCH_RING_SIZE = 3;
+
+// Pyramid detection reads the AOI in tiles of this size, plus a halo of the largest window
+static const int PYRAMID_TILE_SIZE = 2048;
+
+// The model converts each window to float as it copies it into its input, with overlapping windows every pixel gets
+// converted several times. The serial AOI is converted once per tile of this size plus a window instead.
+static const int FLOAT_TILE_SIZE = 512;
+
+// Server tiles straddling pyramid tiles are kept this long, within this much memory
+static const size_t BLOCK_CACHE_SIZE = 128 << 20;
+static const seconds BLOCK_CACHE_TTL(120);
+
+// WMTS tiles come from the tile service layer, WMS GetMap requests to the same service read its imagery layer instead.
+// The WMS reader checks that its endpoint offers that layer before reading.
+static const char* WMTS_LAYER = "DigitalGlobe:ImageryTileService";
+static const char* WMS_LAYER = "DigitalGlobe:Imagery";
+static const char* DGCS_WMS_URL = "https://services.digitalglobe.com/mapservice/wmsaccess";
+static const char* EVWHS_WMS_URL = "https://evwhs.digitalglobe.com/mapservice/wmsaccess";
+
+// Vector tiles span this many zoom levels below the imagery, which defaults to this zoom when it's unknown
+static const int TILE_ZOOM_LEVELS = 8;
+static const int DEFAULT_TILE_ZOOM = 16;
+
+// Raster size, and the projected and geographic coordinates of the image corners and center. Images with the same
+// description share their pixel grid, the geographic coordinates tell their projections apart.
+static string describeGeoreference(const GeoImage& image)
+{
+    auto size = image.size();
+    vector<cv::Point2d> points = {
+        { 0.0, 0.0 },
+        { (double) size.width, 0.0 },
+        { (double) size.width, (double) size.height },
+        { 0.0, (double) size.height },
+        { size.width / 2.0, size.height / 2.0 }
+    };
+
+    unique_ptr<Transformation> projToLL;
+    if(!image.spatialReference().isLocal()) {
+        unique_ptr<Transformation> llToProj(image.spatialReference().fromLatLon());
+        projToLL.reset(llToProj->inverse());
+    }
+
+    ostringstream oss;
+    oss << std::setprecision(17) << size.width << ' ' << size.height;
+    for(const auto& point : points) {
+        auto proj = image.pixelToProj().transform(point);
+        oss << ' ' << proj.x << ' ' << proj.y;
+        if(projToLL) {
+            auto ll = projToLL->transform(proj);
+            oss << ' ' << ll.x << ' ' << ll.y;
+        }
+    }
+
+    return oss.str();
+}
+
+static string projectionWkt(const string& path)
+{
+    auto dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+    DG_CHECK(dataset, "Error opening %s", path.c_str());
+
+    string wkt = GDALGetProjectionRef(dataset);
+    GDALClose(dataset);
+    return wkt;
+}
+
+// Whether two WKT projections describe the same coordinate system, images without one only match each other
+static bool sameProjection(const string& a, const string& b)
+{
+    if(a.empty() || b.empty()) {
+        return a.empty() && b.empty();
+    }
+
+    auto srA = OSRNewSpatialReference(a.c_str());
+    auto srB = OSRNewSpatialReference(b.c_str());
+    auto same = srA && srB && OSRIsSame(srA, srB);
+    OSRDestroySpatialReference(srA);
+    OSRDestroySpatialReference(srB);
+    return same;
+}
+
+static const char* actionName(Action action)
+{
+    switch(action) {
+        case Action::DETECT:
+            return "detect";
+        case Action::LANDCOVER:
+            return "landcover";
+        case Action::FETCH:
+            return "fetch";
+        default:
+            return "unknown";
+    }
+}
+
 OpenSpaceNet::OpenSpaceNet(const OpenSpaceNetArgs &args) :
     args_(args)
 {
@@ -93,26 +243,93 @@ OpenSpaceNet::OpenSpaceNet(const OpenSpaceNetArgs &args) :
 
 void OpenSpaceNet::process()
 {
+    startTime_ = steady_clock::now();
+    receivedSignal.store(0);
+    StopSignals stopSignals;
+
+    // The service round trips and connection warm-up overlap with loading the model
+    std::future<void> imageReady;
     if(args_.source > Source::LOCAL) {
-        initMapServiceImage();
+        imageReady = async(launch::async, [this]() { initMapServiceImage(); });
     } else if(args_.source == Source::LOCAL) {
-        initLocalImage();
+        initLocalImage(args_.image);
     } else {
         DG_ERROR_THROW("Input source not specified");
     }
 
-    initModel();
-    printModel();
-    initFeatureSet();
+    if(args_.action != Action::FETCH) {
+        initModel();
+    }
+
+    if(imageReady.valid()) {
+        imageReady.get();
+    }
 
-    if(concurrent_) {
-        processConcurrent();
+    if(args_.action == Action::FETCH) {
+        fetchTiles();
     } else {
-        processSerial();
+        printModel();
+        initFeatureSet();
+
+        // A series of images shares the model, the output layer and, when their georeferencing matches, the AOI.
+        // Each image is processed in turn, windows of different images never share a batch.
+        auto numImages = std::max<size_t>(1, args_.images.size());
+        for(size_t i = 0; i < numImages && !stopRequested(); ++i) {
+            if(numImages > 1) {
+                skipLine();
+                OSN_LOG(info) << "Image " << i + 1 << " of " << numImages << ": " << args_.images[i];
+                if(i) {
+                    initLocalImage(args_.images[i]);
+                }
+                schema_.set(sourceField_, Field(FieldType::STRING, args_.images[i]));
+                source_ = args_.images[i];
+
+                completedBlocks_.clear();
+                totalBlocks_ = 0;
+                windowsProcessed_ = 0;
+                totalWindows_ = 0;
+            }
+
+            if(args_.action == Action::LANDCOVER) {
+                // Blocks that aren't a multiple of the window size get re-blocked while streaming
+                bbox_ = { cv::Point {0, 0} , image_->size() };
+                concurrent_ = true;
+            }
+
+            if(concurrent_) {
+                processConcurrent();
+            } else {
+                processSerial();
+            }
+
+            if(!stopped_) {
+                ++completedImages_;
+            }
+        }
+    }
+
+    if(limiter_) {
+        OSN_LOG(info) << "Requests waited " << limiter_->waited().count() << " s for the rate limit.";
+    }
+
+    if(stopped_) {
+        OSN_LOG(warning) << "Processing stopped early (" << stopReason_ << "), output is incomplete.";
+    }
+
+    if(!args_.progressPath.empty()) {
+        writeProgress();
+    }
+
+    if(tiles_) {
+        OSN_LOG(info) << "Building vector tiles...";
+        tiles_.reset();
+    }
+
+    if(featureSet_) {
+        OSN_LOG(info) << "Saving feature set...";
+        featureSet_.reset();
     }
 
-    OSN_LOG(info) << "Saving feature set..." ;
-    featureSet_.reset();
 }
 
 void OpenSpaceNet::initModel()
@@ -136,11 +353,6 @@ void OpenSpaceNet::initModel()
 
     float confidence = 0;
     if(args_.action == Action::LANDCOVER) {
-        const auto& blockSize = image_->blockSize();
-        if(blockSize.width % windowSize_.width == 0 && blockSize.height % windowSize_.height == 0) {
-            bbox_ = { cv::Point {0, 0} , image_->size() };
-            concurrent_ = true;
-        }
         stepSize_ = windowSize_;
     } else if(args_.action == Action::DETECT) {
         if(args_.stepSize) {
@@ -153,26 +365,65 @@ void OpenSpaceNet::initModel()
     }
 
     model_->setConfidence(confidence);
+
+    labels_ = LabelTable(model_->metadata().labels());
+    if(!args_.includeLabels.empty() || !args_.excludeLabels.empty()) {
+        classFilter_ = labels_.classFilter(args_.includeLabels, args_.excludeLabels);
+    }
 }
 
-void OpenSpaceNet::initLocalImage()
+void OpenSpaceNet::initLocalImage(const string& imagePath)
 {
     OSN_LOG(info) << "Opening image..." ;
-    image_ = make_unique<GdalImage>(args_.image);
+
+    // The previous image of a series may have the reduced image open
+    image_.reset();
+    auto path = imagePath;
+    if(args_.targetGsd > 0) {
+        reducedImage_ = make_unique<ReducedImage>(imagePath, args_.targetGsd);
+        if(reducedImage_->nativeGsd() <= 0) {
+            OSN_LOG(warning) << "The image ground sample distance is unknown, argument --target-gsd is ignored.";
+        } else if(reducedImage_->reduced()) {
+            OSN_LOG(info) << "Reading the image at " << args_.targetGsd << " m instead of its native "
+                          << reducedImage_->nativeGsd() << " m";
+        } else {
+            OSN_LOG(info) << "The image is already at " << reducedImage_->nativeGsd() << " m, reading it unchanged";
+        }
+        path = reducedImage_->path();
+    }
+    image_ = make_unique<GdalImage>(path);
+
+    imagePath_ = path;
+
+    // Images of a series usually share their pixel grid, the AOI and its transformation are kept for those
+    auto georeference = describeGeoreference(*image_);
+    if(pixelToLL_ && georeference == georeference_) {
+        OSN_LOG(debug) << "The image has the same georeferencing as the previous one";
+        return;
+    }
+
+    auto geographic = !image_->spatialReference().isLocal();
+    DG_CHECK(!pixelToLL_ || geographic == geographic_,
+             "Images of a series must all have geographic metadata, or none of them");
+    georeference_ = georeference;
+    geographic_ = geographic;
+    pixelToLLShifted_ = false;
 
     bbox_ = cv::Rect{ { 0, 0 }, image_->size() };
     bool ignoreArgsBbox = false;
 
     TransformationChain llToPixel;
-    if (!image_->spatialReference().isLocal()) {
+    if (geographic) {
         llToPixel = {
                 image_->spatialReference().fromLatLon(),
                 image_->pixelToProj().inverse()
         };
         sr_ = SpatialReference::WGS84;
     } else {
-        OSN_LOG(warning) << "Image has geometric metadata which cannot be converted to WGS84.  "
-                            "Output will be in native space, and some output formats will fail.";
+        if(args_.outputCrs == "wgs84") {
+            OSN_LOG(warning) << "Image has geometric metadata which cannot be converted to WGS84.  "
+                                "Output will be in native space, and some output formats will fail.";
+        }
 
         if (args_.bbox) {
             OSN_LOG(warning) << "Supplying the --bbox option implicitly requests a conversion from "
@@ -186,8 +437,6 @@ void OpenSpaceNet::initLocalImage()
         llToPixel = { image_->pixelToProj().inverse() };
     }
 
-    pixelToLL_ = llToPixel.inverse();
-
     if(args_.bbox && !ignoreArgsBbox) {
         auto bbox = llToPixel.transformToInt(*args_.bbox);
 
@@ -195,18 +444,84 @@ void OpenSpaceNet::initLocalImage()
         DG_CHECK(intersect.width && intersect.height, "Input image and the provided bounding box do not intersect");
 
         if(bbox != intersect) {
-            auto llIntersect = pixelToLL_->transform(intersect);
+            auto llIntersect = unique_ptr<Transformation>(llToPixel.inverse())->transform(intersect);
             OSN_LOG(info) << "Bounding box adjusted to " << llIntersect.tl() << " : " << llIntersect.br();
         }
 
         bbox_ = intersect;
     }
+
+    if(args_.outputCrs == "wgs84") {
+        pixelToLL_ = llToPixel.inverse();
+        axisAligned_ = false;
+    } else {
+        initOutputCrs();
+    }
+}
+
+void OpenSpaceNet::initOutputCrs()
+{
+    // Native and pixel output are a single affine transformation, without going through latitude and longitude
+    if(args_.outputCrs == "native") {
+        // The output layer takes the coordinate system of the first image, the images of a series can't change it
+        auto projection = projectionWkt(imagePath_);
+        DG_CHECK(!pixelToLL_ || sameProjection(projection, projection_),
+                 "Native output requires the images of a series to share their coordinate system, %s has another one",
+                 imagePath_.c_str());
+        projection_ = projection;
+
+        OSN_LOG(info) << "Output is in the image's coordinate system";
+        pixelToLL_ = TransformationChain { image_->pixelToProj().inverse() }.inverse();
+        sr_ = image_->spatialReference();
+
+        // North up images keep the windows axis aligned
+        cv::Point2d origin = pixelToLL_->transform(cv::Point(0, 0));
+        cv::Point2d right = pixelToLL_->transform(cv::Point(1, 0));
+        cv::Point2d down = pixelToLL_->transform(cv::Point(0, 1));
+        axisAligned_ = right.y == origin.y && down.x == origin.x;
+    } else if(args_.outputCrs == "pixel") {
+        // Pixels of the original image, when it is read at a reduced resolution
+        auto xFactor = reducedImage_ ? reducedImage_->xFactor() : 1.0;
+        auto yFactor = reducedImage_ ? reducedImage_->yFactor() : 1.0;
+        OSN_LOG(info) << "Output is in image pixel coordinates";
+        pixelToLL_ = TransformationChain {
+                new AffineTransformation { 0.0, 1.0 / xFactor, 0.0, 0.0, 0.0, 1.0 / yFactor }
+        }.inverse();
+        sr_ = SpatialReference();
+        axisAligned_ = true;
+    } else {
+        DG_CHECK(geographic_, "Output in %s requires an image with geographic metadata", args_.outputCrs.c_str());
+
+        auto srs = OSRNewSpatialReference(nullptr);
+        char* wkt = nullptr;
+        if(OSRSetFromUserInput(srs, args_.outputCrs.c_str()) == OGRERR_NONE) {
+            OSRExportToWkt(srs, &wkt);
+        }
+        OSRDestroySpatialReference(srs);
+        DG_CHECK(wkt, "Unknown output CRS: %s", args_.outputCrs.c_str());
+        sr_ = SpatialReference(wkt);
+        CPLFree(wkt);
+
+        OSN_LOG(info) << "Output is in " << args_.outputCrs;
+        axisAligned_ = false;
+        unique_ptr<Transformation> llToOutput(sr_.fromLatLon());
+        pixelToLL_ = TransformationChain {
+                llToOutput->inverse(),
+                image_->spatialReference().fromLatLon(),
+                image_->pixelToProj().inverse()
+        }.inverse();
+    }
 }
 
 void OpenSpaceNet::initMapServiceImage()
 {
     DG_CHECK(args_.bbox, "Bounding box must be specified");
 
+    if(!args_.rateLimit.empty()) {
+        limiter_ = make_unique<RateLimiter>(args_.rateLimit[0], args_.rateLimit.size() > 1 ? args_.rateLimit[1] : 0,
+                                            args_.rateLimitPath);
+    }
+
     bool wmts = true;
     string url;
     switch(args_.source) {
@@ -235,25 +550,52 @@ void OpenSpaceNet::initMapServiceImage()
 
     client_->connect();
 
+    zoom_ = args_.zoom;
+    if(args_.targetGsd > 0) {
+        auto latitude = args_.bbox->y + args_.bbox->height / 2;
+        zoom_ = zoomForGsd(args_.targetGsd, latitude);
+        OSN_LOG(info) << "Using zoom level " << zoom_ << " for " << args_.targetGsd << " m, its resolution is "
+                      << zoomGsd(zoom_, latitude) << " m";
+    }
+
     if(wmts) {
         client_->setImageFormat("image/jpeg");
-        client_->setLayer("DigitalGlobe:ImageryTileService");
+        client_->setLayer(WMTS_LAYER);
         client_->setTileMatrixSet("EPSG:3857");
-        client_->setTileMatrixId((format("EPSG:3857:%1d") % args_.zoom).str());
+        client_->setTileMatrixId((format("EPSG:3857:%1d") % zoom_).str());
     } else {
-        client_->setTileMatrixId(lexical_cast<string>(args_.zoom));
+        client_->setTileMatrixId(lexical_cast<string>(zoom_));
     }
 
     unique_ptr<Transformation> llToProj(client_->spatialReference().fromLatLon());
-    auto projBbox = llToProj->transform(*args_.bbox);
-    image_.reset(client_->imageFromArea(projBbox));
+    projBbox_ = llToProj->transform(*args_.bbox);
+    image_ = openServiceImage();
 
     unique_ptr<Transformation> projToPixel(image_->pixelToProj().inverse());
-    bbox_ = projToPixel->transformToInt(projBbox);
+    bbox_ = projToPixel->transformToInt(projBbox_);
     pixelToLL_ = TransformationChain { std::move(llToProj), std::move(projToPixel) }.inverse();
 
     auto msImage = dynamic_cast<MapServiceImage*>(image_.get());
     msImage->setMaxConnections(args_.maxConnections);
+
+    // Fetching stores the service's JPEG responses as they are, which only tile sized WMS requests return
+    auto wmsRequestSize = args_.action == Action::FETCH ? 0 : args_.wmsRequestSize;
+    if(wmts && (wmsRequestSize > 0 || args_.action == Action::FETCH)) {
+        wms_ = make_unique<WmsReader>(args_.source == Source::EVWHS ? EVWHS_WMS_URL : DGCS_WMS_URL, WMS_LAYER,
+                                      args_.token, args_.credentials, image_->pixelToProj(), image_->size(),
+                                      image_->blockSize(), args_.maxConnections, wmsRequestSize,
+                                      limiter_.get());
+        if(args_.action != Action::FETCH) {
+            OSN_LOG(info) << "Reading with WMS requests of up to " << wms_->requestSize() << " pixels";
+        }
+        wms_->checkLayer();
+        wms_->warmUp();
+    }
+}
+
+unique_ptr<GeoImage> OpenSpaceNet::openServiceImage() const
+{
+    return unique_ptr<GeoImage>(client_->imageFromArea(projBbox_));
 }
 
 void OpenSpaceNet::initFeatureSet()
@@ -267,243 +609,775 @@ void OpenSpaceNet::initFeatureSet()
             { FieldType::STRING, "top_five", 254 }
     };
 
+    if(args_.images.size() > 1) {
+        definitions.push_back({ FieldType::STRING, "source", 254 });
+    }
+
     if(args_.producerInfo) {
         definitions.push_back({ FieldType::STRING, "username", 50 });
         definitions.push_back({ FieldType::STRING, "app", 50 });
         definitions.push_back({ FieldType::STRING, "app_ver", 50 });
     }
 
+    schema_ = FeatureSchema(definitions);
+    topCatField_ = schema_.index("top_cat");
+    topScoreField_ = schema_.index("top_score");
+    dateField_ = schema_.index("date");
+    topFiveField_ = schema_.index("top_five");
+    if(args_.images.size() > 1) {
+        sourceField_ = schema_.index("source");
+    }
+
+    if(args_.producerInfo) {
+        schema_.set(schema_.index("username"), Field(FieldType::STRING, loginUser()));
+        schema_.set(schema_.index("app"), Field(FieldType::STRING, "OpenSpaceNet"));
+        schema_.set(schema_.index("app_ver"), Field(FieldType::STRING, OPENSPACENET_VERSION_STRING));
+    }
+
+    classFields_.clear();
+    for(size_t i = 0; i < labels_.size(); ++i) {
+        classFields_.emplace_back(FieldType::STRING, labels_.label((ClassId) i).c_str());
+    }
+
+    if(args_.outputFormat == "mbtiles") {
+        initVectorTiles();
+        return;
+    }
+
     VectorOpenMode openMode = args_.append ? APPEND : OVERWRITE;
 
     featureSet_ = make_unique<FeatureSet>(args_.outputPath, args_.outputFormat, openMode);
 
     if (openMode == OVERWRITE) {
-        layer_ = featureSet_->createLayer(args_.layerName, sr_, args_.geometryType, definitions);
+        layer_ = featureSet_->createLayer(args_.layerName, sr_, args_.geometryType, schema_.definitions());
     } else if (openMode == APPEND) {
         if (featureSet_->hasLayer(args_.layerName)) {
             layer_ = featureSet_->layer(args_.layerName);
         } else {
-            layer_ = featureSet_->createLayer(args_.layerName, sr_, args_.geometryType, definitions);
+            layer_ = featureSet_->createLayer(args_.layerName, sr_, args_.geometryType, schema_.definitions());
         }
     }
 }
 
+void OpenSpaceNet::initVectorTiles()
+{
+    DG_CHECK(args_.source > Source::LOCAL || geographic_, "MBTiles output requires an image with geographic metadata");
+
+    // The tiles go from the resolution of the imagery up to where the detections are too small to make out
+    auto maxZoom = zoom_;
+    string srs = "EPSG:4326";
+    if(args_.source == Source::LOCAL) {
+        maxZoom = imageZoom(imagePath_);
+        if(maxZoom < 0) {
+            OSN_LOG(warning) << "The image resolution is unknown, writing vector tiles up to zoom level "
+                             << DEFAULT_TILE_ZOOM;
+            maxZoom = DEFAULT_TILE_ZOOM;
+        }
+
+        if(args_.outputCrs == "native") {
+            srs = projectionWkt(imagePath_);
+        } else if(args_.outputCrs != "wgs84") {
+            srs = args_.outputCrs;
+        }
+    }
+
+    auto minZoom = std::max(0, maxZoom - TILE_ZOOM_LEVELS);
+    OSN_LOG(info) << "Writing vector tiles for zoom levels " << minZoom << " to " << maxZoom;
+    tiles_ = make_unique<VectorTileWriter>(args_.outputPath, args_.layerName, srs, minZoom, maxZoom,
+                                           args_.geometryType == GeometryType::POINT, args_.images.size() > 1);
+}
+
 void OpenSpaceNet::processConcurrent()
 {
-    recursive_mutex queueMutex;
-    deque<pair<cv::Point, cv::Mat>> blockQueue;
-    Semaphore haveWork;
-    atomic<bool> cancelled = ATOMIC_VAR_INIT(false);
+    // Reads still in flight after a stop request may call back after we return, so the state they touch must be
+    // owned by the callbacks
+    const auto& blockSize = image_->blockSize();
+    auto queuedBlockSize = blockSize;
+    auto reblock = blockSize.width % windowSize_.width || blockSize.height % windowSize_.height;
+    if(reblock) {
+        queuedBlockSize = SuperBlockReader::superBlockSize(blockSize, windowSize_);
+    }
+
+    // Blocks in flight are bounded by the download concurrency plus what the consumer holds, buffers beyond that
+    // come from the regular allocator. The blocks DeepCore reads are its own, the pool holds the blocks assembled,
+    // split or reloaded here. The images of a series share it until their block geometry changes, the blocks of the
+    // previous image are all released by then.
+    if(!blockPool_ || blockPool_->blockSize() != queuedBlockSize) {
+        const cv::MatAllocator* fallback = cv::Mat::getStdAllocator();
+        if(args_.hugePages) {
+            fallback = ImageAllocator::get();
+        }
+        blockPool_ = make_unique<BlockBufferPool>(queuedBlockSize, 2 * args_.maxConnections + 2, fallback);
+    }
+
+    auto blockQueue = std::make_shared<BlockQueue>((size_t) args_.queueMemory << 20, args_.scratchPath,
+                                                   blockPool_.get());
+    std::shared_ptr<MultiProgressDisplay> progressDisplay(new MultiProgressDisplay({ "Loading", "Classifying" }));
+    auto curBlockRead = std::make_shared<atomic<size_t>>(0);
+    auto cancelled = std::make_shared<atomic<bool>>(false);
 
-    MultiProgressDisplay progressDisplay({ "Loading", "Classifying" });
     if(!args_.quiet) {
-        progressDisplay.start();
+        progressDisplay->start();
     }
 
-    auto numBlocks = image_->numBlocks().area();
-    size_t curBlockRead = 0;
-    image_->setReadFunc([&blockQueue, &queueMutex, &haveWork, &curBlockRead, numBlocks, &progressDisplay](const cv::Point& origin, cv::Mat&& block) -> bool {
-        {
-            lock_guard<recursive_mutex> lock(queueMutex);
-            blockQueue.push_front(make_pair(origin, std::move(block)));
+    auto numNativeBlocks = image_->numBlocks().area();
+    size_t numBlocks = numNativeBlocks;
+    std::shared_ptr<SuperBlockReader> superBlocks;
+    if(reblock) {
+        superBlocks = std::make_shared<SuperBlockReader>(image_->size(), blockSize, windowSize_,
+                                                         [blockQueue](const cv::Point& origin, cv::Mat&& block) {
+            blockQueue->push(origin, std::move(block));
+            return true;
+        }, blockPool_.get());
+        numBlocks = superBlocks->numBlocks();
+        OSN_LOG(info) << "Re-blocking " << blockSize << " image blocks into " << superBlocks->blockSize()
+                      << " blocks aligned to the window size";
+    }
+
+    totalBlocks_ = numBlocks;
+    auto readFunc = [this, blockQueue, superBlocks, curBlockRead, numNativeBlocks, progressDisplay](const cv::Point& origin, cv::Mat&& block) -> bool {
+        // Stop intake, whatever is already queued gets drained by the consumer
+        if(stopRequested()) {
+            return false;
         }
 
-        progressDisplay.update(0, (float)++curBlockRead / numBlocks);
-        haveWork.notify();
+        if(superBlocks) {
+            superBlocks->add(origin, std::move(block));
+        } else {
+            blockQueue->push(origin, std::move(block));
+        }
+        progressDisplay->update(0, (float)++*curBlockRead / numNativeBlocks);
 
         return true;
-    });
+    };
 
-    image_->setOnError([&cancelled, &haveWork](std::exception_ptr) {
-        cancelled.store(true);
-        haveWork.notify();
-    });
+    auto onError = [cancelled, blockQueue](std::exception_ptr) {
+        cancelled->store(true);
+        blockQueue->notify();
+    };
 
-    image_->readBlocksInAoi();
+    // WMS requests span many blocks, they are split into blocks here instead of by the image. With a rate limit,
+    // server tiles are read here as well, the image's own download threads can't wait for the limiter before their
+    // requests.
+    std::future<void> blockRead;
+    if(wms_ || limiter_) {
+        blockRead = async(launch::async, [this, readFunc, onError]() {
+            try {
+                if(wms_) {
+                    wms_->readBlocks(readFunc, blockPool_.get());
+                } else {
+                    BlockFetcher fetcher([this]() { return openServiceImage(); }, args_.maxConnections, 0,
+                                         BLOCK_CACHE_TTL, limiter_.get());
+                    fetcher.readBlocks(readFunc);
+                }
+            } catch(...) {
+                onError(std::current_exception());
+                throw;
+            }
+        });
+    } else {
+        image_->setReadFunc(readFunc);
+        image_->setOnError(onError);
+        image_->readBlocksInAoi();
+    }
 
     size_t curBlockClass = 0;
-    auto consumerFuture = async(launch::async, [this, &blockQueue, &queueMutex, &haveWork, &cancelled, &progressDisplay, numBlocks, &curBlockRead, &curBlockClass]() {
-        while(curBlockClass < numBlocks && !cancelled.load()) {
-            pair<cv::Point, cv::Mat> item;
-            {
-                lock_guard<recursive_mutex> lock(queueMutex);
-                if(!blockQueue.empty()) {
-                    item = blockQueue.back();
-                    blockQueue.pop_back();
-                } else {
-                    queueMutex.unlock();
-                    haveWork.wait();
-                    continue;
+    auto consumerFuture = async(launch::async, [this, blockQueue, cancelled, progressDisplay, numBlocks, &curBlockClass]() {
+        PredictionStore predictions(args_.topClasses);
+        cv::Mat floatBlock;
+        while(curBlockClass < numBlocks && !cancelled->load()) {
+            cv::Point origin;
+            cv::Mat block;
+
+            // Wake up periodically, signals and the time limit can't notify us
+            if(!blockQueue->pop(origin, block, milliseconds(100))) {
+                if(stopRequested()) {
+                    break;
                 }
+                continue;
+            } else if(drainExpired()) {
+                OSN_LOG(warning) << "Grace period expired, discarding " << blockQueue->size() + 1 << " queued blocks.";
+                break;
             }
 
-            SlidingWindowSlicer slicer(item.second, windowSize_, stepSize_);
+            // Converted once for all the windows overlapping on it, the buffer is reused from block to block
+            block.convertTo(floatBlock, CV_32F);
+            SlidingWindowSlicer slicer(floatBlock, windowSize_, stepSize_);
 
             Subsets subsets;
             copy(slicer, back_inserter(subsets));
 
-            auto predictions = model_->detect(subsets);
-
-            if(!args_.excludeLabels.empty()) {
-                std::set<string> excludeLabels(args_.excludeLabels.begin(), args_.excludeLabels.end());
-                auto filtered = filterLabels(predictions, FilterType::Exclude, excludeLabels);
-                predictions = move(filtered);
-            }
-
-            if(!args_.includeLabels.empty()) {
-                std::set<string> includeLabels(args_.includeLabels.begin(), args_.includeLabels.end());
-                auto filtered = filterLabels(predictions, FilterType::Include, includeLabels);
-                predictions = move(filtered);
-            }
-
-            for(auto& prediction : predictions) {
-                prediction.window.x += item.first.x;
-                prediction.window.y += item.first.y;
-                addFeature(prediction.window, prediction.predictions);
-            }
+            predictions.clear();
+            predictions.append(labels_, model_->detect(subsets), classFilter_);
+            predictions.offset(origin);
+            addFeatures(predictions);
 
-            progressDisplay.update(1, (float)++curBlockClass / numBlocks);
+            completedBlocks_.push_back(origin);
+            progressDisplay->update(1, (float)++curBlockClass / numBlocks);
         }
     });
 
     consumerFuture.wait();
-    progressDisplay.stop();
+    progressDisplay->stop();
 
-    image_->rethrowIfError();
+    if(blockRead.valid()) {
+        blockRead.get();
+    } else {
+        image_->rethrowIfError();
+    }
 
     skipLine();
+    OSN_LOG(debug) << "Block buffers: " << blockPool_->hits() << " reused, " << blockPool_->misses() << " allocated";
+    if(blockQueue->spilled()) {
+        OSN_LOG(info) << blockQueue->spilled() << " blocks were spilled to disk.";
+    }
+    if(superBlocks && superBlocks->pending()) {
+        OSN_LOG(warning) << superBlocks->pending() << " partially read blocks were discarded.";
+    }
 }
 
 void OpenSpaceNet::processSerial()
 {
-    // Adjust the transformation to shift to the bounding box
-    auto& pixelToLL = dynamic_cast<TransformationChain&>(*pixelToLL_);
-    pixelToLL.chain.push_front(new AffineTransformation {
-        (double) bbox_.x, 1.0, 0.0,
-        (double) bbox_.y, 0.0, 1.0
-    });
-    pixelToLL.compact();
-
-    skipLine();
-    OSN_LOG(info)  << "Reading image...";
+    // Adjust the transformation to shift to the bounding box, once for all the images sharing it
+    if(!pixelToLLShifted_) {
+        auto& pixelToLL = dynamic_cast<TransformationChain&>(*pixelToLL_);
+        pixelToLL.chain.push_front(new AffineTransformation {
+            (double) bbox_.x, 1.0, 0.0,
+            (double) bbox_.y, 0.0, 1.0
+        });
+        pixelToLL.compact();
+        pixelToLLShifted_ = true;
+    }
 
-    unique_ptr<boost::progress_display> openProgress;
-    if(!args_.quiet) {
-        openProgress = make_unique<boost::progress_display>(50);
+    // The AOI, or the pyramid tiles, are read into large buffers, these can be backed with huge pages
+    unique_ptr<ScopedDefaultAllocator> imageAllocator;
+    if(args_.hugePages) {
+        imageAllocator = make_unique<ScopedDefaultAllocator>(ImageAllocator::get());
     }
 
-    auto startTime = high_resolution_clock::now();
-    auto mat = GeoImage::readImage(*image_, bbox_, [&openProgress](float progress) -> bool {
-        size_t curProgress = (size_t)roundf(progress*50);
-        if(openProgress && openProgress->count() < curProgress) {
-            *openProgress += curProgress - openProgress->count();
+    auto sizes = calcSizes();
+    unique_ptr<TiledPyramid> pyramid;
+    cv::Mat mat;
+    unique_ptr<SlidingWindowSlicer> slicer;
+    unique_ptr<SaliencyMap> saliency;
+    duration<double> duration;
+    if(sizes.size() > 1) {
+        // Pyramid levels are built tile by tile while detecting, instead of from the whole AOI
+        pyramid = make_unique<TiledPyramid>(bbox_.size(), windowSize_, sizes, PYRAMID_TILE_SIZE);
+        totalWindows_ = pyramid->totalWindows();
+    } else {
+        skipLine();
+        OSN_LOG(info)  << "Reading image...";
+
+        unique_ptr<boost::progress_display> openProgress;
+        if(!args_.quiet) {
+            openProgress = make_unique<boost::progress_display>(50);
         }
-        return true;
-    });
 
-    duration<double> duration = high_resolution_clock::now() - startTime;
-    OSN_LOG(info) << "Reading time " << duration.count() << " s";
+        auto startTime = high_resolution_clock::now();
+        try {
+            auto progressFunc = [this, &openProgress](float progress) -> bool {
+                size_t curProgress = (size_t)roundf(progress*50);
+                if(openProgress && openProgress->count() < curProgress) {
+                    *openProgress += curProgress - openProgress->count();
+                }
+                return !stopRequested();
+            };
+            if(wms_) {
+                mat = wms_->read(bbox_, progressFunc);
+            } else if(limiter_) {
+                // Only the fetcher sees the individual server tile requests the limiter has to pace
+                BlockFetcher fetcher([this]() { return openServiceImage(); }, args_.maxConnections, 0, BLOCK_CACHE_TTL,
+                                     limiter_.get());
+                mat = fetcher.read(bbox_, progressFunc);
+            } else {
+                mat = GeoImage::readImage(*image_, bbox_, progressFunc);
+            }
+        } catch(...) {
+            if(!stopped_) {
+                throw;
+            }
+        }
+
+        if(stopped_) {
+            OSN_LOG(warning) << "Reading was interrupted, no detection was performed.";
+            return;
+        }
+
+        duration = high_resolution_clock::now() - startTime;
+        OSN_LOG(info) << "Reading time " << duration.count() << " s";
+
+        slicer = make_unique<SlidingWindowSlicer>(mat, model_->metadata().windowSize(), sizes, windowSize_);
+        totalWindows_ = slicer->slidingWindow().totalWindows();
+
+        if(args_.saliencyThreshold > 0) {
+            saliency = make_unique<SaliencyMap>(mat);
+        }
+    }
 
     skipLine();
-    OSN_LOG(info) << "Detecting features...";
+    if(pyramid) {
+        OSN_LOG(info) << "Detecting features in " << pyramid->numTiles() << " tiles...";
+    } else {
+        OSN_LOG(info) << "Detecting features...";
+    }
 
     unique_ptr<boost::progress_display> detectProgress;
     if(!args_.quiet) {
         detectProgress = make_unique<boost::progress_display>(50);
     }
 
-    SlidingWindowSlicer slicer(mat, model_->metadata().windowSize(), calcSizes(), windowSize_);
-    auto it = slicer.begin();
-    std::vector<WindowPrediction> predictions;
-    int progress = 0;
+    PredictionStore batchPredictions(args_.topClasses);
+    PredictionSpill predictions(batchPredictions.topK(), (size_t) args_.predictionMemory << 20, args_.scratchPath,
+                                args_.nms);
+    size_t progress = 0;
 
-    startTime = high_resolution_clock::now();
+    auto startTime = high_resolution_clock::now();
 
-    while(it != slicer.end()) {
-        Subsets subsets;
-        for(int i = 0; i < model_->batchSize() && it != slicer.end(); ++i, ++it) {
-            subsets.push_back(*it);
+    // Slicing and pyramid resizing for the next batches run on a separate thread while the model works on the
+    // current one
+    BoundedQueue<WindowBatch> batches(BATCH_RING_SIZE);
+    auto batchSize = (size_t) model_->batchSize();
+    auto saliencyThreshold = args_.saliencyThreshold;
+    auto skipFeatureless = !args_.saliencyCalibrate;
+    auto producer = async(launch::async, [&]() {
+        WindowBatcher batcher(batches, batchSize, skipFeatureless);
+        try {
+            if(pyramid) {
+                sliceTiles(*pyramid, batcher);
+            } else {
+                FloatWindows floatWindows(mat, FLOAT_TILE_SIZE, sizes.front().first);
+                for(auto it = slicer->begin(); it != slicer->end() && !stopRequested(); ++it) {
+                    auto featureless = saliency && saliency->stdDev(it->rect) < saliencyThreshold;
+                    auto subset = *it;
+                    if(!featureless || !skipFeatureless) {
+                        subset.image = floatWindows.window(subset.rect, subset.image);
+                    }
+                    if(!batcher.add(subset, featureless)) {
+                        break;
+                    }
+                }
+            }
+            batcher.flush();
+        } catch(...) {
+            batches.close();
+            throw;
         }
+        batches.close();
+    });
+
+    // After a stop request, the queued batches are still classified within the grace period, the partial results are
+    // written out below
+    size_t featurelessWindows = 0;
+    size_t detections = 0;
+    size_t featurelessDetections = 0;
+    try {
+        WindowBatch batch;
+        while(batches.pop(batch)) {
+            if(drainExpired()) {
+                OSN_LOG(warning) << "Grace period expired, discarding the queued batches.";
+                break;
+            }
+
+            if(!batch.subsets.empty()) {
+                batchPredictions.append(labels_, model_->detect(batch.subsets), classFilter_);
+            }
+
+            if(!skipFeatureless) {
+                for(size_t i = 0; i < batchPredictions.size(); ++i) {
+                    if(!batchPredictions.numScores(i)) {
+                        continue;
+                    }
+
+                    ++detections;
+                    if(std::count(batch.featurelessKept.begin(), batch.featurelessKept.end(), batchPredictions.window(i))) {
+                        ++featurelessDetections;
+                    }
+                }
+            }
+
+            predictions.append(batchPredictions);
 
-        auto predictionBatch = model_->detect(subsets);
-        predictions.insert(predictions.end(), predictionBatch.begin(), predictionBatch.end());
+            featurelessWindows += batch.featureless;
+            auto windows = batch.subsets.size() + (skipFeatureless ? batch.featureless : 0);
+            windowsProcessed_ += windows;
 
-        if(detectProgress) {
-            progress += subsets.size();
-            auto curProgress = (size_t)round((double)progress / slicer.slidingWindow().totalWindows() * 50);
-            if(detectProgress && detectProgress->count() < curProgress) {
-                *detectProgress += curProgress - detectProgress->count();
+            if(detectProgress) {
+                progress += windows;
+                auto curProgress = (size_t)round((double)progress / totalWindows_ * 50);
+                if(detectProgress && detectProgress->count() < curProgress) {
+                    *detectProgress += curProgress - detectProgress->count();
+                }
             }
         }
+    } catch(...) {
+        batches.close();
+        throw;
+    }
+
+    batches.close();
+    try {
+        producer.get();
+    } catch(...) {
+        // Tile reads fail once a stop was requested
+        if(!stopped_) {
+            throw;
+        }
     }
 
     duration = high_resolution_clock::now() - startTime;
     OSN_LOG(info) << "Detection time " << duration.count() << " s" ;
-
-    if(!args_.excludeLabels.empty()) {
-        skipLine();
-        OSN_LOG(info) << "Performing category filtering..." ;
-        std::set<string> excludeLabels(args_.excludeLabels.begin(), args_.excludeLabels.end());
-        auto filtered = filterLabels(predictions, FilterType::Exclude, excludeLabels);
-        predictions = move(filtered);
+    OSN_LOG(info)  << "Batch preparation waited " << batches.pushWait().count() << " s for the model, the model waited "
+                   << batches.popWait().count() << " s for batches";
+
+    if(args_.saliencyThreshold > 0 && skipFeatureless) {
+        OSN_LOG(info) << featurelessWindows << " featureless windows were skipped.";
+    } else if(args_.saliencyThreshold > 0) {
+        auto recall = detections ? 100.0 * (detections - featurelessDetections) / detections : 100.0;
+        OSN_LOG(info) << "Saliency calibration: " << featurelessWindows << " of " << windowsProcessed_
+                      << " windows are below the threshold, skipping them would lose " << featurelessDetections
+                      << " of " << detections << " detections (" << recall << "% recall).";
     }
 
-    if(!args_.includeLabels.empty()) {
-        skipLine();
-        OSN_LOG(info) << "Performing category filtering..." ;
-        std::set<string> includeLabels(args_.includeLabels.begin(), args_.includeLabels.end());
-        auto filtered = filterLabels(predictions, FilterType::Include, includeLabels);
-        predictions = move(filtered);
+    if(predictions.runs()) {
+        OSN_LOG(info) << predictions.size() << " predictions were spilled to disk in " << predictions.runs() << " runs.";
     }
 
+    size_t featureCount = 0;
+    auto addBatch = [this, &featureCount](const PredictionStore& batch) {
+        for(size_t i = 0; i < batch.size(); ++i) {
+            featureCount += batch.numScores(i) ? 1 : 0;
+        }
+        addFeatures(batch);
+    };
+
     if(args_.nms) {
         skipLine();
         OSN_LOG(info) << "Performing non-maximum suppression..." ;
-        auto filtered = nonMaxSuppression(predictions, args_.overlap / 100);
-        predictions = move(filtered);
+        predictions.nonMaxSuppression(args_.overlap / 100, addBatch);
+    } else {
+        predictions.forEach(addBatch);
+    }
+
+    OSN_LOG(info) << featureCount << " features detected.";
+}
+
+void OpenSpaceNet::sliceTiles(TiledPyramid& pyramid, WindowBatcher& batcher)
+{
+    // Tile extents overlap by the halo, each pixel is only read once and the overlap comes from the cache. Tiles are
+    // read one after another, so the cache is never accessed concurrently.
+    HaloCache haloCache(bbox_.width, PYRAMID_TILE_SIZE);
+
+    // Web service regions are read tile by tile, so the server tiles straddling two regions are only downloaded once.
+    // Tiles are read one at a time and the halos come from the cache, so no two reads ever ask for the same server
+    // tile at once.
+    unique_ptr<BlockFetcher> fetcher;
+    if(args_.source > Source::LOCAL && !wms_) {
+        fetcher = make_unique<BlockFetcher>([this]() { return openServiceImage(); }, args_.maxConnections,
+                                            BLOCK_CACHE_SIZE, BLOCK_CACHE_TTL, limiter_.get());
+    }
+
+    // When every level is downsampled, WMS tiles are decoded straight at a reduced scale. Their halos then aren't on
+    // whole reduced pixels, so the cache is bypassed, re-reading them costs a fraction at that scale.
+    auto scale = wms_ ? pyramid.readScale() : 1;
+    if(scale > 1) {
+        OSN_LOG(info) << "Decoding the image at 1/" << scale << " scale, no pyramid level needs finer pixels";
+    }
+
+    // Tiles are converted to float once, on the reading thread, for all the overlapping windows of their levels
+    auto readTile = [this, &pyramid, &haloCache, &fetcher, scale](size_t tile) {
+        cv::Mat converted;
+        if(scale > 1) {
+            wms_->read(pyramid.tileExtent(tile) + bbox_.tl(), [this](float) { return !stopRequested(); },
+                       scale).convertTo(converted, CV_32F);
+            return converted;
+        }
+
+        auto image = haloCache.read(pyramid.tileExtent(tile), [this, &fetcher](const cv::Rect& rect) {
+            if(wms_) {
+                return wms_->read(rect + bbox_.tl(), [this](float) { return !stopRequested(); });
+            } else if(fetcher) {
+                return fetcher->read(rect + bbox_.tl(), [this](float) { return !stopRequested(); });
+            }
+
+            return GeoImage::readImage(*image_, rect + bbox_.tl(), [this](float) -> bool {
+                return !stopRequested();
+            });
+        });
+        image.convertTo(converted, CV_32F);
+        return converted;
+    };
+
+    // The next tile is read while the current one is sliced
+    auto nextTile = async(launch::async, readTile, 0);
+    auto sliced = true;
+    for(size_t tile = 0; tile < pyramid.numTiles(); ++tile) {
+        auto image = nextTile.get();
+        if(tile + 1 < pyramid.numTiles()) {
+            nextTile = async(launch::async, readTile, tile + 1);
+        }
+
+        unique_ptr<SaliencyMap> saliency;
+        if(args_.saliencyThreshold > 0) {
+            saliency = make_unique<SaliencyMap>(image);
+        }
+
+        auto origin = pyramid.tileExtent(tile).tl();
+        sliced = pyramid.slice(tile, image, [this, &batcher, &saliency, origin, scale](const cv::Rect& window,
+                                                                                       const cv::Mat& windowImage) {
+            auto local = window - origin;
+            local = { local.x / scale, local.y / scale, local.width / scale, local.height / scale };
+            auto featureless = saliency && saliency->stdDev(local) < args_.saliencyThreshold;
+            return batcher.add({ window, windowImage }, featureless);
+        });
+
+        if(!sliced) {
+            break;
+        }
+    }
+
+    // Levels with windows larger than a tile come from the mosaic the tiles were downsampled into
+    if(sliced && !stopRequested() && !pyramid.mosaic().empty()) {
+        unique_ptr<SaliencyMap> saliency;
+        if(args_.saliencyThreshold > 0) {
+            saliency = make_unique<SaliencyMap>(pyramid.mosaic());
+        }
+
+        auto mosaicScale = pyramid.mosaicScale();
+        pyramid.sliceCoarse([this, &batcher, &saliency, mosaicScale](const cv::Rect& window,
+                                                                     const cv::Mat& windowImage) {
+            cv::Rect local((int) (window.x / mosaicScale.x), (int) (window.y / mosaicScale.y),
+                           (int) (window.width / mosaicScale.x), (int) (window.height / mosaicScale.y));
+            auto featureless = saliency && saliency->stdDev(local) < args_.saliencyThreshold;
+            return batcher.add({ window, windowImage }, featureless);
+        });
+    }
+
+    OSN_LOG(debug) << haloCache.reused() << " halo pixels were reused instead of read again";
+    if(wms_) {
+        OSN_LOG(debug) << wms_->requests() << " WMS requests, the last ones " << wms_->requestSize() << " pixels square";
+    }
+    if(fetcher) {
+        OSN_LOG(debug) << "Server tiles: " << fetcher->cacheHits() << " served from the cache";
+    }
+}
+
+void OpenSpaceNet::fetchTiles()
+{
+    OSN_LOG(info) << "Fetching tiles into " << args_.outputPath << "...";
+
+    auto cache = std::make_shared<TileCache>(args_.outputPath, zoom_, wms_ ? "jpg" : "png");
+    auto blockSize = image_->blockSize();
+    auto numBlocks = image_->numBlocks();
+    totalBlocks_ = numBlocks.area();
+
+    auto tileAt = [this, blockSize](const cv::Point& origin) {
+        cv::Point2d center(origin.x + blockSize.width / 2.0, origin.y + blockSize.height / 2.0);
+        return image_->pixelToProj().transform(center);
+    };
+
+    // Downloads still in flight after a stop request may call back after we return, so the state they touch
+    // must be owned by the callbacks
+    struct FetchState
+    {
+        mutex fetchMutex;
+        condition_variable haveTile;
+        atomic<bool> cancelled = ATOMIC_VAR_INIT(false);
+        size_t curBlock = 0;
+        int bands = 0;
+        vector<cv::Point> completed;
+        MultiProgressDisplay progressDisplay { { "Downloading" } };
+    };
+    auto state = std::make_shared<FetchState>();
+
+    if(!args_.quiet) {
+        state->progressDisplay.start();
+    }
+
+    size_t totalBlocks = totalBlocks_;
+    auto tileWritten = [state, totalBlocks](const cv::Point& origin, int bands) {
+        lock_guard<mutex> lock(state->fetchMutex);
+        state->bands = bands;
+        state->completed.push_back(origin);
+        state->progressDisplay.update(0, (float)++state->curBlock / totalBlocks);
+        state->haveTile.notify_one();
+    };
+
+    auto onError = [state](std::exception_ptr) {
+        state->cancelled.store(true);
+        state->haveTile.notify_one();
+    };
+
+    auto startTime = high_resolution_clock::now();
+    auto writeBlock = [this, cache, tileAt, tileWritten](const cv::Point& origin, cv::Mat&& block) -> bool {
+        if(stopRequested()) {
+            return false;
+        }
+
+        cache->writeTile(cache->tileAt(tileAt(origin)), block);
+        tileWritten(origin, block.channels());
+        return true;
+    };
+
+    // With a rate limit, server tiles are read here, the image's own download threads can't wait for the limiter
+    // before their requests
+    std::future<void> blockRead;
+    if(limiter_ && !wms_) {
+        blockRead = async(launch::async, [this, writeBlock, onError]() {
+            try {
+                BlockFetcher fetcher([this]() { return openServiceImage(); }, args_.maxConnections, 0,
+                                     BLOCK_CACHE_TTL, limiter_.get());
+                fetcher.readBlocks(writeBlock);
+            } catch(...) {
+                onError(std::current_exception());
+                throw;
+            }
+        });
+    } else if(wms_) {
+        // The WMS responses are JPEG, which GDAL reads back as RGB
+        blockRead = async(launch::async, [this, cache, tileAt, tileWritten, onError]() {
+            try {
+                wms_->readEncodedBlocks([this, cache, tileAt, tileWritten](const cv::Point& origin,
+                                                                           vector<uchar>&& data) {
+                    if(stopRequested()) {
+                        return false;
+                    }
+                    cache->writeTile(cache->tileAt(tileAt(origin)), data);
+                    tileWritten(origin, 3);
+                    return true;
+                });
+            } catch(...) {
+                onError(std::current_exception());
+                throw;
+            }
+        });
+    } else {
+        image_->setReadFunc(writeBlock);
+        image_->setOnError(onError);
+        image_->readBlocksInAoi();
+    }
+
+    int bands;
+    {
+        unique_lock<mutex> lock(state->fetchMutex);
+        while(state->curBlock < totalBlocks_ && !state->cancelled.load() && !stopRequested()) {
+            state->haveTile.wait_for(lock, milliseconds(100));
+        }
+        completedBlocks_ = state->completed;
+        bands = state->bands;
+    }
+
+    state->progressDisplay.stop();
+    if(blockRead.valid()) {
+        try {
+            blockRead.get();
+        } catch(...) {
+            // Tile writes stop once a stop was requested
+            if(!stopped_) {
+                throw;
+            }
+        }
+    } else {
+        image_->rethrowIfError();
+    }
+    skipLine();
+
+    duration<double> duration = high_resolution_clock::now() - startTime;
+    OSN_LOG(info) << "Fetched " << completedBlocks_.size() << " tiles in " << duration.count() << " s";
+
+    if(stopped_) {
+        return;
+    }
+
+    OSN_LOG(info) << "Verifying the tile cache...";
+    size_t missing = 0;
+    for(int y = 0; y < numBlocks.height; ++y) {
+        for(int x = 0; x < numBlocks.width; ++x) {
+            cv::Point origin(x * blockSize.width, y * blockSize.height);
+            if(!cache->hasTile(cache->tileAt(tileAt(origin)))) {
+                ++missing;
+            }
+        }
     }
+    DG_CHECK(!missing, "%d of %d tiles are missing from the tile cache", (int) missing, (int) totalBlocks_);
 
-    OSN_LOG(info) << predictions.size() << " features detected.";
+    cache->writeDescription(blockSize, bands);
+    OSN_LOG(info) << "Tile cache is complete, use --image " << cache->descriptionPath() << " to process it.";
+}
 
-    for(const auto& prediction : predictions) {
-        addFeature(prediction.window, prediction.predictions);
+void OpenSpaceNet::addFeatures(const PredictionStore& predictions)
+{
+    for(size_t i = 0; i < predictions.size(); ++i) {
+        addFeature(predictions, i);
     }
 }
 
-void OpenSpaceNet::addFeature(const cv::Rect &window, const vector<Prediction> &predictions)
+cv::Point2d OpenSpaceNet::outputPoint(const cv::Point& point) const
 {
-    if(predictions.empty()) {
+    cv::Point2d transformed = pixelToLL_->transform(point);
+
+    // Rounded coordinates print shorter in the text formats
+    auto precision = args_.coordinatePrecision;
+    if(precision > 0) {
+        transformed.x = std::round(transformed.x / precision) * precision;
+        transformed.y = std::round(transformed.y / precision) * precision;
+    }
+
+    return transformed;
+}
+
+void OpenSpaceNet::addFeature(const PredictionStore& predictions, size_t row)
+{
+    if(!predictions.numScores(row)) {
         return;
     }
 
+    auto window = predictions.window(row);
+
     switch (args_.geometryType) {
         case GeometryType::POINT:
         {
             cv::Point center(window.x + window.width / 2, window.y + window.height / 2);
-            auto point = pixelToLL_->transform(center);
-            layer_.addFeature(Feature(new Point(point),
-                              move(createFeatureFields(predictions))));
+            auto point = outputPoint(center);
+            if(tiles_) {
+                tiles_->addFeature({ point }, labels_.label(predictions.classId(row)), predictions.score(row),
+                                   source_);
+            } else {
+                layer_.addFeature(Feature(new Point(point),
+                                  move(createFeatureFields(predictions, row))));
+            }
         }
             break;
 
         case GeometryType::POLYGON:
         {
-            std::vector<cv::Point> points = {
-                    window.tl(),
-                    { window.x + window.width, window.y },
-                    window.br(),
-                    { window.x, window.y + window.height },
-                    window.tl()
-            };
-
-            std::vector<cv::Point2d> llPoints;
-            for(const auto& point : points) {
-                auto llPoint = pixelToLL_->transform(point);
-                llPoints.push_back(llPoint);
+            if(axisAligned_) {
+                // The window stays a rectangle along the output axes, two of its corners describe it
+                auto tl = outputPoint(window.tl());
+                auto br = outputPoint(window.br());
+                ringPoints_ = { tl, { br.x, tl.y }, br, { tl.x, br.y }, tl };
+            } else {
+                const cv::Point points[] = {
+                        window.tl(),
+                        { window.x + window.width, window.y },
+                        window.br(),
+                        { window.x, window.y + window.height },
+                        window.tl()
+                };
+
+                ringPoints_.clear();
+                for(const auto& point : points) {
+                    ringPoints_.push_back(outputPoint(point));
+                }
             }
 
-            layer_.addFeature(Feature(new Polygon(LinearRing(llPoints)),
-                                      move(createFeatureFields(predictions))));
+            if(tiles_) {
+                tiles_->addFeature(ringPoints_, labels_.label(predictions.classId(row)), predictions.score(row),
+                                   source_);
+            } else {
+                layer_.addFeature(Feature(new Polygon(LinearRing(ringPoints_)),
+                                          move(createFeatureFields(predictions, row))));
+            }
         }
             break;
 
@@ -512,30 +1386,24 @@ void OpenSpaceNet::addFeature(const cv::Rect &window, const vector<Prediction> &
     }
 }
 
-Fields OpenSpaceNet::createFeatureFields(const vector<Prediction> &predictions) {
-    Fields fields = {
-            { "top_cat", { FieldType::STRING, predictions[0].label.c_str() } },
-            { "top_score", { FieldType ::REAL, predictions[0].confidence } },
-            { "date", { FieldType ::DATE, time(nullptr) } }
-    };
+Fields OpenSpaceNet::createFeatureFields(const PredictionStore& predictions, size_t row) {
+    schema_.set(topCatField_, classFields_[predictions.classId(row)]);
+    schema_.set(topScoreField_, Field(FieldType::REAL, predictions.score(row)));
+    schema_.set(dateField_, Field(FieldType::DATE, time(nullptr)));
 
     ptree top5;
-    for(const auto& prediction : predictions) {
-        top5.put(prediction.label, prediction.confidence);
+    for(size_t k = 0; k < predictions.numScores(row); ++k) {
+        auto prediction = predictions.prediction(row, k);
+        top5.put(labels_.label(prediction.classId), prediction.score);
     }
 
     ostringstream oss;
     write_json(oss, top5);
 
-    fields["top_five"] = Field(FieldType::STRING, oss.str());
-
-    if(args_.producerInfo) {
-        fields["username"] = { FieldType ::STRING, loginUser() };
-        fields["app"] = { FieldType::STRING, "OpenSpaceNet"};
-        fields["app_ver"] =  { FieldType::STRING, OPENSPACENET_VERSION_STRING };
-    }
+    schema_.set(topFiveField_, Field(FieldType::STRING, oss.str()));
 
-    return std::move(fields);
+    // The feature takes its own copy
+    return schema_.fields();
 }
 
 void OpenSpaceNet::printModel()
@@ -565,6 +1433,82 @@ void OpenSpaceNet::skipLine() const
     }
 }
 
+bool OpenSpaceNet::stopRequested()
+{
+    if(stopped_) {
+        return true;
+    }
+
+    string reason;
+    int signum = receivedSignal.load();
+    if(signum) {
+        reason = signum == SIGINT ? "SIGINT" : "SIGTERM";
+    } else if(args_.timeLimit > 0 && steady_clock::now() - startTime_ >= seconds(args_.timeLimit)) {
+        reason = "time limit";
+    } else {
+        return false;
+    }
+
+    lock_guard<mutex> lock(stopMutex_);
+    if(!stopped_) {
+        stopReason_ = reason;
+        drainDeadline_ = steady_clock::now() + seconds(args_.gracePeriod);
+        OSN_LOG(warning) << "Stop requested (" << reason << "), finishing in-flight work within "
+                         << args_.gracePeriod << " s...";
+        stopped_ = true;
+    }
+
+    return true;
+}
+
+bool OpenSpaceNet::drainExpired() const
+{
+    return stopped_ && steady_clock::now() >= drainDeadline_;
+}
+
+void OpenSpaceNet::writeProgress() const
+{
+    ptree progress;
+    progress.put("status", stopped_ ? "stopped" : "completed");
+    if(stopped_) {
+        progress.put("reason", stopReason_);
+    }
+    progress.put("action", actionName(args_.action));
+    progress.put("output", args_.outputPath);
+    progress.put("layer", args_.layerName);
+    progress.put("bbox.x", bbox_.x);
+    progress.put("bbox.y", bbox_.y);
+    progress.put("bbox.width", bbox_.width);
+    progress.put("bbox.height", bbox_.height);
+
+    // Blocks and windows below are those of the image being processed when the series stopped
+    if(args_.images.size() > 1) {
+        progress.put("images.total", args_.images.size());
+        progress.put("images.completed", completedImages_);
+    }
+
+    if(totalBlocks_) {
+        progress.put("blocks.total", totalBlocks_);
+        ptree completed;
+        for(const auto& origin : completedBlocks_) {
+            ptree block;
+            block.put("x", origin.x);
+            block.put("y", origin.y);
+            completed.push_back(make_pair("", block));
+        }
+        progress.add_child("blocks.completed", completed);
+    } else {
+        // Windows are processed in order, the count tells how far the run got
+        progress.put("windows.total", totalWindows_);
+        progress.put("windows.processed", windowsProcessed_);
+    }
+
+    ofstream ofs(args_.progressPath);
+    DG_CHECK(!ofs.fail(), "Error opening progress file %s for writing.", args_.progressPath.c_str());
+    write_json(ofs, progress);
+    OSN_LOG(info) << "Progress written to " << args_.progressPath;
+}
+
 SizeSteps OpenSpaceNet::calcSizes() const
 {
     if(args_.pyramidWindowSizes.empty()) {
@@ -19,7 +19,17 @@
 #ifndef OPENSPACENET_OPENSPACENET_H
 #define OPENSPACENET_OPENSPACENET_H
 
+#include "BlockBufferPool.h"
+#include "ClassPrediction.h"
+#include "FeatureSchema.h"
 #include "OpenSpaceNetArgs.h"
+#include "PredictionStore.h"
+#include "RateLimiter.h"
+#include "ReadResolution.h"
+#include "TiledPyramid.h"
+#include "VectorTileWriter.h"
+#include "WindowBatcher.h"
+#include "WmsReader.h"
 #include <classification/Model.h>
 #include <classification/Prediction.h>
 #include <geometry/SpatialReference.h>
@@ -31,6 +41,9 @@
 #include <vector/FeatureSet.h>
 #include <vector/Layer.h>
 #include <utility/Logging.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
 namespace dg { namespace osn {
 
@@ -42,30 +55,82 @@ public:
 
 private:
     void initModel();
-    void initLocalImage();
+    void initLocalImage(const std::string& imagePath);
+    void initOutputCrs();
     void initMapServiceImage();
+    std::unique_ptr<deepcore::imagery::GeoImage> openServiceImage() const;
     void initFeatureSet();
+    void initVectorTiles();
     void processConcurrent();
     void processSerial();
-    void addFeature(const cv::Rect& window, const std::vector<deepcore::classification::Prediction>& predictions);
-    deepcore::vector::Fields createFeatureFields(const std::vector<deepcore::classification::Prediction> &predictions);
+    void sliceTiles(TiledPyramid& pyramid, WindowBatcher& batcher);
+    void fetchTiles();
+    void addFeatures(const PredictionStore& predictions);
+    void addFeature(const PredictionStore& predictions, size_t row);
+    cv::Point2d outputPoint(const cv::Point& point) const;
+    deepcore::vector::Fields createFeatureFields(const PredictionStore& predictions, size_t row);
     void printModel();
     void skipLine() const;
     deepcore::imagery::SizeSteps calcSizes() const;
+    bool stopRequested();
+    bool drainExpired() const;
+    void writeProgress() const;
 
     const OpenSpaceNetArgs& args_;
     std::shared_ptr<deepcore::network::HttpCleanup> cleanup_;
     std::unique_ptr<deepcore::classification::Model> model_;
+    // Declared before image_, pooled blocks may still be referenced until the image is gone
+    std::unique_ptr<BlockBufferPool> blockPool_;
+    // Declared before image_, which may have the reduced image open
+    std::unique_ptr<ReducedImage> reducedImage_;
+    std::unique_ptr<RateLimiter> limiter_;
     std::unique_ptr<deepcore::imagery::GeoImage> image_;
     std::unique_ptr<deepcore::imagery::MapServiceClient> client_;
+    // Declared after image_ and limiter_, it refers to both
+    std::unique_ptr<WmsReader> wms_;
     std::unique_ptr<deepcore::vector::FeatureSet> featureSet_;
+    std::unique_ptr<VectorTileWriter> tiles_;
+    LabelTable labels_;
+    std::vector<bool> classFilter_;
     cv::Point stepSize_;
     cv::Size windowSize_;
     bool concurrent_ = false;
     cv::Rect bbox_;
+    // The bounding box in the projection of the web service
+    cv::Rect2d projBbox_;
+    int zoom_ = 0;
     std::unique_ptr<deepcore::geometry::Transformation> pixelToLL_;
+    bool pixelToLLShifted_ = false;
+    // pixelToLL_ maps pixel rectangles to rectangles along the output axes
+    bool axisAligned_ = false;
+    // The file the current image was opened from, the reduced image with --target-gsd
+    std::string imagePath_;
+    std::string georeference_;
+    // The WKT projection of the images, with native output
+    std::string projection_;
+    bool geographic_ = false;
     deepcore::vector::Layer layer_;
+    FeatureSchema schema_;
+    size_t topCatField_ = 0;
+    size_t topScoreField_ = 0;
+    size_t dateField_ = 0;
+    size_t topFiveField_ = 0;
+    size_t sourceField_ = 0;
+    std::string source_;
+    std::vector<deepcore::vector::Field> classFields_;
+    std::vector<cv::Point2d> ringPoints_;
     deepcore::geometry::SpatialReference sr_;
+
+    std::chrono::steady_clock::time_point startTime_;
+    std::chrono::steady_clock::time_point drainDeadline_;
+    std::atomic<bool> stopped_ = ATOMIC_VAR_INIT(false);
+    std::mutex stopMutex_;
+    std::string stopReason_;
+    std::vector<cv::Point> completedBlocks_;
+    size_t totalBlocks_ = 0;
+    size_t windowsProcessed_ = 0;
+    size_t totalWindows_ = 0;
+    size_t completedImages_ = 0;
 };
 
 } } // namespace dg { namespace osn {
@@ -18,6 +18,7 @@
 
 #include "OpenSpaceNet.h"
 
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/lexical_cast.hpp>
@@ -41,12 +42,15 @@ using namespace deepcore;
 using boost::program_options::variables_map;
 using boost::program_options::name_with_default;
 using boost::adaptors::reverse;
+using boost::algorithm::all;
+using boost::algorithm::is_digit;
 using boost::bad_lexical_cast;
 using boost::filesystem::path;
 using boost::iequals;
 using boost::join;
 using boost::lexical_cast;
 using boost::make_unique;
+using boost::starts_with;
 using boost::tokenizer;
 using boost::escaped_list_separator;
 using boost::to_lower;
@@ -59,6 +63,7 @@ using std::end;
 using std::endl;
 using std::move;
 using std::ofstream;
+using std::sort;
 using std::string;
 using std::unique_ptr;
 using vector::FeatureSet;
@@ -71,7 +76,8 @@ static const string OSN_USAGE =
         "Actions:\n"
         "  help     \t\t\t Show this help message\n"
         "  detect   \t\t\t Perform feature detection\n"
-        "  landcover\t\t\t Perform land cover classification\n";
+        "  landcover\t\t\t Perform land cover classification\n"
+        "  fetch    \t\t\t Download map service tiles into a local tile cache\n";
 
 static const string OSN_DETECT_USAGE =
     "Run OpenSpaceNet in feature detection mode.\n\n"
@@ -83,6 +89,12 @@ static const string OSN_LANDCOVER_USAGE =
         "Usage:\n"
         "  OpenSpaceNet landcover <input options> <output options> <processing options>\n\n";
 
+static const string OSN_FETCH_USAGE =
+    "Download map service tiles into a local tile cache without running a model. The --output option is the cache\n"
+    "directory, the staged tiles can then be processed with --image <cache directory>/tiles.xml.\n\n"
+        "Usage:\n"
+        "  OpenSpaceNet fetch <web service input options> --output <cache directory>\n\n";
+
 OpenSpaceNetArgs::OpenSpaceNetArgs() :
     localOptions_("Local Image Input Options"),
     webOptions_("Web Service Input Options"),
@@ -93,9 +105,14 @@ OpenSpaceNetArgs::OpenSpaceNetArgs() :
     generalOptions_("General Options"),
     supportedFormats_(FeatureSet::supportedFormats())
 {
+    // Vector tiles are written by OpenSpaceNet itself
+    supportedFormats_.push_back("mbtiles");
+    sort(supportedFormats_.begin(), supportedFormats_.end());
+
     localOptions_.add_options()
-        ("image", po::value<string>()->value_name("PATH"),
-         "If this is specified, the input will be taken from a local image.")
+        ("image", po::value<std::vector<string>>()->multitoken()->value_name("PATH [PATH...]"),
+         "If this is specified, the input will be taken from a local image. Several images of the same area, i.e. from "
+         "different dates, are processed one after another into one output layer.")
         ;
 
     webOptions_.add_options()
@@ -115,6 +132,14 @@ OpenSpaceNetArgs::OpenSpaceNetArgs() :
         ("mapId", po::value<string>()->value_name(name_with_default("MAPID", MAPSAPI_MAPID)), "MapsAPI map id to use.")
         ("num-downloads", po::value<int>()->value_name(name_with_default("NUM", maxConnections)),
          "Used to speed up downloads by allowing multiple concurrent downloads to happen at once.")
+        ("wms-request-size", po::value<int>()->value_name("PIXELS"),
+         "Read dgcs and evwhs imagery with WMS requests of up to PIXELS square instead of one request per tile. "
+         "The request size adapts to the observed latency.")
+        ("rate-limit", po::value<std::vector<string>>()->multitoken()->value_name("REQUESTS [BYTES]"),
+         "Limit service requests to REQUESTS per second and, if specified, downloads to BYTES per second. Tiles "
+         "are counted at their decoded size, WMS responses at their compressed size. Zero is unlimited.")
+        ("rate-limit-file", po::value<string>()->value_name("PATH"),
+         "Share the --rate-limit budget with every process using the same file.")
         ;
 
     string outputDescription = "Output file format for the results. Valid values are: ";
@@ -134,6 +159,11 @@ OpenSpaceNetArgs::OpenSpaceNetArgs() :
          "The output layer name, index name, or table name.")
         ("type", po::value<string>()->value_name(name_with_default("TYPE", "polygon")),
          "Output geometry type.  Currently only point and polygon are valid.")
+        ("output-crs", po::value<string>()->value_name(name_with_default("CRS", "wgs84")),
+         "Coordinate reference system of the output geometries for local images. Valid values are wgs84, native "
+         "for the image's own coordinate system, pixel for image pixel coordinates, and EPSG:code.")
+        ("coordinate-precision", po::value<double>()->value_name("VALUE"),
+         "Round the output coordinates to multiples of this value, in output CRS units, e.g. 1e-7 degrees.")
         ("producer-info", "Add user name, application name, and application version to the output feature set.")
         ("append", "Append to an existing vector set. If the output does not exist, it will be created.")
         ;
@@ -146,11 +176,34 @@ OpenSpaceNetArgs::OpenSpaceNetArgs() :
         ("window-size", po::cvSize_value()->min_tokens(1)->value_name("WIDTH [HEIGHT]"),
          "Overrides the original model's window size. Window size can be specified in either one or two dimensions. If "
          "only one dimension is specified, the window will be square. This parameter is optional and not recommended.")
+        ("time-limit", po::value<int>()->value_name("SECONDS"),
+         "Stop processing after the specified number of seconds. Features detected up to that point are saved.")
+        ("grace-period", po::value<int>()->value_name(name_with_default("SECONDS", gracePeriod)),
+         "Time allowed for in-flight work to finish after an interrupt signal or when the time limit is reached.")
+        ("progress-file", po::value<string>()->value_name("PATH"),
+         "Write a JSON progress record to this file when processing ends, whether completed or stopped early.")
+        ("queue-memory", po::value<int>()->value_name("MB"),
+         "Memory limit for image blocks waiting to be processed. Blocks past this limit are compressed and spilled "
+         "to the scratch directory. By default all blocks are kept in memory.")
+        ("prediction-memory", po::value<int>()->value_name(name_with_default("MB", predictionMemory)),
+         "Memory limit for predictions accumulated before non-maximum suppression and output. Predictions past this "
+         "limit are spilled to the scratch directory. 0 means no limit.")
+        ("scratch-dir", po::value<string>()->value_name("PATH"),
+         "Directory for blocks and predictions spilled from memory. The default is the system temporary directory.")
+        ("target-gsd", po::value<float>()->value_name("METERS"),
+         "Read the imagery at the ground sample distance the model was trained on. Web services use the closest zoom "
+         "level, local images finer than this are reduced while reading.")
+        ("huge-pages",
+         "Allocate image buffers of 8 MB or more aligned to huge pages and advise the kernel to back them with "
+         "transparent huge pages.")
         ;
 
     detectOptions_.add_options()
         ("confidence", po::value<float>()->value_name(name_with_default("PERCENT", confidence)),
          "Minimum percent score for results to be included in the output.")
+        ("top-classes", po::value<int>()->value_name("COUNT"),
+         "Maximum number of classes written for each detection, by descending score. By default all the classes "
+         "above the confidence threshold are written.")
         ("step-size", po::cvPoint_value()->min_tokens(1)->value_name("WIDTH [HEIGHT]"),
          "Sliding window step size. Default value is 20% of the model window size. Step size can be specified in "
          "either one or two dimensions. If only one dimension is specified, the step size will be the same in both directions.")
@@ -168,6 +221,11 @@ OpenSpaceNetArgs::OpenSpaceNetArgs() :
          "Sliding window sizes to match to pyramid levels. --pyramid-step-sizes argument must be present and have the same number of values.")
         ("pyramid-step-sizes", po::value<std::vector<std::string>>()->multitoken()->value_name("SIZE [SIZE...]"),
          "Sliding window step sizes to match to pyramid levels. --pyramid-window-sizes argument must be present and have the same number of values.")
+        ("saliency-threshold", po::value<float>()->value_name("STDDEV"),
+         "Skip windows whose pixel standard deviation is below this value without classifying them. The default of 0 "
+         "classifies every window.")
+        ("saliency-calibrate",
+         "Classify every window and report how many detections --saliency-threshold would have lost.")
         ;
 
     loggingOptions_.add_options()
@@ -375,6 +433,8 @@ static Action parseAction(string str)
         return Action::DETECT;
     } else if(str == "landcover") {
         return Action::LANDCOVER;
+    } else if(str == "fetch") {
+        return Action::FETCH;
     }
 
     return Action::UNKNOWN;
@@ -417,6 +477,17 @@ void OpenSpaceNetArgs::printUsage(Action action) const
             cout << OSN_DETECT_USAGE << visibleOptions_;
             break;
 
+        case Action::FETCH:
+        {
+            po::options_description desc;
+            desc.add(webOptions_);
+            desc.add(loggingOptions_);
+            desc.add(generalOptions_);
+
+            cout << OSN_FETCH_USAGE << desc;
+        }
+            break;
+
         default:
             cout << OSN_USAGE << visibleOptions_;
             break;
@@ -433,15 +504,30 @@ void OpenSpaceNetArgs::validateArgs()
     bool unusedNms= false;
     bool unusedPyramid = false;
     bool unusedConfidence = false;
+    bool unusedSaliency = false;
+    bool requireModel = true;
+    string actionName;
     switch (action) {
         case Action::DETECT:
             break;
 
+        case Action::FETCH:
+            unusedStepSize = true;
+            unusedNms= true;
+            unusedPyramid = true;
+            unusedConfidence = true;
+            unusedSaliency = true;
+            requireModel = false;
+            actionName = "FETCH";
+            break;
+
         case Action::LANDCOVER:
             unusedStepSize = true;
             unusedNms= true;
             unusedPyramid = true;
             unusedConfidence = true;
+            unusedSaliency = true;
+            actionName = "LANDCOVER";
             break;
 
         case Action::HELP:
@@ -452,19 +538,23 @@ void OpenSpaceNetArgs::validateArgs()
     }
 
     if (unusedStepSize && (stepSize.get() != nullptr)) {
-        OSN_LOG(warning) << "Argument --step-size is unused for LANDCOVER.";
+        OSN_LOG(warning) << "Argument --step-size is unused for " << actionName << '.';
     }
 
     if (unusedNms && nms) {
-        OSN_LOG(warning) << "Argument --nms is unused for LANDCOVER.";
+        OSN_LOG(warning) << "Argument --nms is unused for " << actionName << '.';
     }
 
     if (unusedPyramid && pyramid) {
-        OSN_LOG(warning) << "Argument --pyramid is unused for LANDCOVER.";
+        OSN_LOG(warning) << "Argument --pyramid is unused for " << actionName << '.';
     }
 
     if (unusedConfidence && confidenceSet) {
-        OSN_LOG(warning) << "Argument --confidence is unused for LANDCOVER.";
+        OSN_LOG(warning) << "Argument --confidence is unused for " << actionName << '.';
+    }
+
+    if (unusedSaliency && saliencyThreshold > 0) {
+        OSN_LOG(warning) << "Argument --saliency-threshold is unused for " << actionName << '.';
     }
 
 
@@ -477,10 +567,12 @@ void OpenSpaceNetArgs::validateArgs()
     bool requireCredentials = false;
     bool requireUrl = false;
     bool unusedUseTiles = true;
+    bool unusedWms = true;
     string sourceName;
 
     switch (source) {
         case Source::LOCAL:
+            DG_CHECK(action != Action::FETCH, "The fetch action requires a web service input.");
             unusedMapId = true;
             unusedToken = true;
             unusedCredentials = true;
@@ -500,6 +592,7 @@ void OpenSpaceNetArgs::validateArgs()
             requireToken = true;
             requireCredentials = true;
             unusedMapId = true;
+            unusedWms = false;
             sourceName = "dgcs or evwhs";
             break;
 
@@ -540,6 +633,18 @@ void OpenSpaceNetArgs::validateArgs()
         OSN_LOG(warning) << "Argument --use-tiles is unused for " << sourceName << '.';
     }
 
+    if (unusedWms && wmsRequestSize > 0) {
+        OSN_LOG(warning) << "Argument --wms-request-size is unused for " << sourceName << '.';
+    }
+
+    if (source != Source::LOCAL && outputCrs != "wgs84") {
+        OSN_LOG(warning) << "Argument --output-crs is unused for " << sourceName << '.';
+    }
+
+    if (source == Source::LOCAL && !rateLimit.empty()) {
+        OSN_LOG(warning) << "Argument --rate-limit is unused for " << sourceName << '.';
+    }
+
 
     if(requireUrl && url.empty()) {
         DG_ERROR_THROW("Argument --url is required for %s.", sourceName.c_str());
@@ -547,9 +652,16 @@ void OpenSpaceNetArgs::validateArgs()
         OSN_LOG(warning) << "Argument --url is unused for " << sourceName << '.';
     }
 
+    if (images.size() > 1) {
+        DG_CHECK(action == Action::DETECT || action == Action::LANDCOVER,
+                 "Several images can only be processed by the detect and landcover actions.");
+    }
+
     // validate model and detection
-    if (modelPath.empty()) {
+    if (requireModel && modelPath.empty()) {
         DG_ERROR_THROW("Argument --model is required.");
+    } else if (!requireModel && !modelPath.empty()) {
+        OSN_LOG(warning) << "Argument --model is unused for " << actionName << '.';
     }
 
     if (!includeLabels.empty() && !excludeLabels.empty()) {
@@ -561,7 +673,9 @@ void OpenSpaceNetArgs::validateArgs()
         DG_ERROR_THROW("Argument --output is required.");
     }
 
-    if(outputFormat  == "shp") {
+    if(action == Action::FETCH) {
+        // The output is a tile cache directory, there are no layers
+    } else if(outputFormat  == "shp") {
         if(!layerName.empty()) {
             OSN_LOG(warning) << "Argument --output-layer is ignored for Shapefile output.";
         }
@@ -570,6 +684,11 @@ void OpenSpaceNetArgs::validateArgs()
         layerName = "skynetdetects";
     }
 
+    if(outputFormat == "mbtiles") {
+        DG_CHECK(!append, "Argument --append is not supported for MBTiles output.");
+        DG_CHECK(outputCrs != "pixel", "MBTiles output requires geographic coordinates, not --output-crs pixel.");
+    }
+
     DG_CHECK(pyramidWindowSizes.size() == pyramidStepSizes.size(),
              "Number of arguments in --pyramid-window-sizes and --pyramid-step-sizes must match.");
 
@@ -581,6 +700,25 @@ void OpenSpaceNetArgs::validateArgs()
         OSN_LOG(warning) << "Argument --step-size is ignored because pyramid levels are specified manually.";
     }
 
+    DG_CHECK(timeLimit >= 0, "Argument --time-limit must not be negative.");
+    DG_CHECK(gracePeriod >= 0, "Argument --grace-period must not be negative.");
+    DG_CHECK(queueMemory >= 0, "Argument --queue-memory must not be negative.");
+    DG_CHECK(predictionMemory >= 0, "Argument --prediction-memory must not be negative.");
+    DG_CHECK(topClasses >= 0, "Argument --top-classes must not be negative.");
+    DG_CHECK(coordinatePrecision >= 0, "Argument --coordinate-precision must not be negative.");
+    DG_CHECK(targetGsd >= 0, "Argument --target-gsd must not be negative.");
+    if(targetGsd > 0 && zoomSet) {
+        OSN_LOG(warning) << "Argument --zoom is ignored because --target-gsd is specified.";
+    }
+    DG_CHECK(wmsRequestSize >= 0, "Argument --wms-request-size must not be negative.");
+    DG_CHECK(rateLimit.size() <= 2, "Argument --rate-limit takes a request rate and an optional byte rate.");
+    for(auto rate : rateLimit) {
+        DG_CHECK(rate >= 0, "Argument --rate-limit must not be negative.");
+    }
+    DG_CHECK(rateLimitPath.empty() || !rateLimit.empty(), "Argument --rate-limit-file requires --rate-limit.");
+    DG_CHECK(saliencyThreshold >= 0, "Argument --saliency-threshold must not be negative.");
+    DG_CHECK(!saliencyCalibrate || saliencyThreshold > 0, "Argument --saliency-calibrate requires --saliency-threshold.");
+
     // Ask for password, if not specified
     if (requireCredentials && !displayHelp && credentials.find(':') == string::npos) {
         promptForPassword();
@@ -616,8 +754,10 @@ void OpenSpaceNetArgs::readArgs(variables_map vm, bool splitArgs) {
     if (readVariable("service", vm, service)) {
         source = parseService(service);
         readWebServiceArgs(vm, splitArgs);
-    } else if (readVariable("image", vm, image)) {
+    } else if (readVariable("image", vm, images, false)) {
+        // Paths are never split, several images are given as separate values
         source = Source::LOCAL;
+        image = images.front();
     }
 
     string actionString;
@@ -655,8 +795,11 @@ void OpenSpaceNetArgs::readWebServiceArgs(variables_map vm, bool splitArgs)
     readVariable("credentials", vm, credentials);
     readVariable("url", vm, url);
     useTiles = vm.find("use-tiles") != vm.end();
-    readVariable("zoom", vm, zoom);
+    zoomSet |= readVariable("zoom", vm, zoom);
     readVariable("num-downloads", vm, maxConnections);
+    readVariable("wms-request-size", vm, wmsRequestSize);
+    readVariable("rate-limit", vm, rateLimit, true);
+    readVariable("rate-limit-file", vm, rateLimitPath);
 }
 
 
@@ -678,6 +821,18 @@ void OpenSpaceNetArgs::readOutputArgs(variables_map vm, bool splitArgs)
     } else {
         DG_ERROR_THROW("Invalid geometry type: %s", typeStr.c_str());
     }
+
+    readVariable("output-crs", vm, outputCrs);
+    to_lower(outputCrs);
+    if(starts_with(outputCrs, "epsg:")) {
+        auto code = outputCrs.substr(5);
+        DG_CHECK(!code.empty() && all(code, is_digit()), "Invalid output CRS: %s", outputCrs.c_str());
+        outputCrs = "EPSG:" + code;
+    } else {
+        DG_CHECK(outputCrs == "wgs84" || outputCrs == "native" || outputCrs == "pixel",
+                 "Invalid output CRS: %s", outputCrs.c_str());
+    }
+    readVariable("coordinate-precision", vm, coordinatePrecision);
     append = vm.find("append") != end(vm);
     producerInfo = vm.find("producer-info") != end(vm);
 }
@@ -688,6 +843,14 @@ void OpenSpaceNetArgs::readProcessingArgs(variables_map vm, bool splitArgs)
     readVariable("max-utilization", vm, maxUtilization);
     readVariable("model", vm, modelPath);
     windowSize = readVariable<cv::Size>("window-size", vm);
+    readVariable("time-limit", vm, timeLimit);
+    readVariable("grace-period", vm, gracePeriod);
+    readVariable("progress-file", vm, progressPath);
+    readVariable("queue-memory", vm, queueMemory);
+    readVariable("prediction-memory", vm, predictionMemory);
+    readVariable("scratch-dir", vm, scratchPath);
+    readVariable("target-gsd", vm, targetGsd);
+    hugePages = vm.find("huge-pages") != end(vm);
 }
 
 void OpenSpaceNetArgs::readFeatureDetectionArgs(variables_map vm, bool splitArgs)
@@ -696,6 +859,7 @@ void OpenSpaceNetArgs::readFeatureDetectionArgs(variables_map vm, bool splitArgs
     readVariable("exclude-labels", vm, excludeLabels, splitArgs);
 
     confidenceSet |= readVariable("confidence", vm, confidence);
+    readVariable("top-classes", vm, topClasses);
 
     readVariable("pyramid-window-sizes", vm, pyramidWindowSizes, true);
     readVariable("pyramid-step-sizes", vm, pyramidStepSizes, true);
@@ -703,6 +867,9 @@ void OpenSpaceNetArgs::readFeatureDetectionArgs(variables_map vm, bool splitArgs
     stepSize = readVariable<cv::Point>("step-size", vm);
     pyramid = vm.find("pyramid") != end(vm);
 
+    readVariable("saliency-threshold", vm, saliencyThreshold);
+    saliencyCalibrate = vm.find("saliency-calibrate") != end(vm);
+
     if(vm.find("nms") != end(vm)) {
         nms = true;
         std::vector<float> args;
@@ -18,11 +18,10 @@
 #ifndef OPENSPACENET_OPENSPACENETARGS_H
 #define OPENSPACENET_OPENSPACENETARGS_H
 
+#include "OpenSpaceNetLog.h"
 #include <boost/program_options.hpp>
-#include <utility/Logging.h>
 #include <vector/Feature.h>
 
-#define OSN_LOG(sev) DG_LOG(OpenSpaceNet, sev)
 #define MAPSAPI_MAPID  "digitalglobe.nal0g75k"
 
 
@@ -43,7 +42,8 @@ enum class Action
     UNKNOWN,
     HELP,
     DETECT,
-    LANDCOVER
+    LANDCOVER,
+    FETCH
 };
 
 class OpenSpaceNetArgs
@@ -54,13 +54,18 @@ public:
     Source source = Source::UNKNOWN;
 
     std::string image;
+    std::vector<std::string> images;
     std::unique_ptr<cv::Rect2d> bbox;
 
     // Web service input options
     std::string token;
     std::string credentials;
     int zoom = 18;
+    bool zoomSet = false;
     int maxConnections = 10;
+    int wmsRequestSize = 0;
+    std::vector<double> rateLimit;
+    std::string rateLimitPath;
     std::string mapId = MAPSAPI_MAPID;
     std::string url;
     bool useTiles=false;
@@ -71,6 +76,9 @@ public:
     std::string outputFormat = "shp";
     std::string outputPath;
     std::string layerName;
+    // "wgs84", "native", "pixel", or "EPSG:code"
+    std::string outputCrs = "wgs84";
+    double coordinatePrecision = 0;
     bool producerInfo = false;
     bool append = false;
 
@@ -79,9 +87,18 @@ public:
     float maxUtilization = 95;
     std::string modelPath;
     std::unique_ptr<cv::Size> windowSize;
+    int timeLimit = 0;
+    int gracePeriod = 30;
+    std::string progressPath;
+    int queueMemory = 0;
+    int predictionMemory = 1024;
+    float targetGsd = 0;
+    std::string scratchPath;
+    bool hugePages = false;
 
     // Feature detection options
     float confidence = 95;
+    int topClasses = 0;
     std::unique_ptr<cv::Point> stepSize;
     bool pyramid = false;
     bool nms = false;
@@ -90,6 +107,8 @@ public:
     std::vector<std::string> excludeLabels;
     std::vector<int> pyramidWindowSizes;
     std::vector<int> pyramidStepSizes;
+    float saliencyThreshold = 0;
+    bool saliencyCalibrate = false;
 
     // Logging options
     bool quiet = false;
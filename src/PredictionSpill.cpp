@@ -0,0 +1,321 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "PredictionSpill.h"
+#include "OpenSpaceNetLog.h"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using boost::filesystem::create_directories;
+using boost::filesystem::path;
+using boost::filesystem::remove_all;
+using boost::filesystem::temp_directory_path;
+using boost::filesystem::unique_path;
+using boost::format;
+using std::ifstream;
+using std::max;
+using std::ofstream;
+using std::string;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
+
+// Rows read from each run at a time, and rows handed to the consumer at a time
+static const size_t RUN_BUFFER_ROWS = 4096;
+static const size_t BATCH_ROWS = 4096;
+
+namespace {
+
+class RunReader
+{
+public:
+    RunReader(const string& filePath, size_t topK) :
+        ifs_(filePath, std::ios::binary),
+        rows_(topK)
+    {
+        DG_CHECK(!ifs_.fail(), "Error opening %s", filePath.c_str());
+        refill();
+    }
+
+    bool done() const
+    {
+        return pos_ >= rows_.size();
+    }
+
+    const PredictionStore& rows() const
+    {
+        return rows_;
+    }
+
+    size_t row() const
+    {
+        return pos_;
+    }
+
+    void next()
+    {
+        if(++pos_ >= rows_.size()) {
+            refill();
+        }
+    }
+
+private:
+    void refill()
+    {
+        rows_.clear();
+        rows_.read(ifs_, RUN_BUFFER_ROWS);
+        pos_ = 0;
+    }
+
+    ifstream ifs_;
+    PredictionStore rows_;
+    size_t pos_ = 0;
+};
+
+// Retained windows bucketed into a sparse grid no finer than the largest window, so windows that intersect always
+// share a cell
+class WindowGrid
+{
+public:
+    explicit WindowGrid(int cellSize) :
+        cellSize_(cellSize)
+    {
+    }
+
+    bool suppresses(const cv::Rect& candidate, double overlapThreshold) const
+    {
+        int c0, r0, c1, r1;
+        cellRange(candidate, c0, r0, c1, r1);
+        for(int r = r0; r <= r1; ++r) {
+            for(int c = c0; c <= c1; ++c) {
+                auto it = cells_.find(key(c, r));
+                if(it == cells_.end()) {
+                    continue;
+                }
+
+                for(const auto& kept : it->second) {
+                    if(overlaps(kept, candidate, overlapThreshold)) {
+                        return true;
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void add(const cv::Rect& window)
+    {
+        int c0, r0, c1, r1;
+        cellRange(window, c0, r0, c1, r1);
+        for(int r = r0; r <= r1; ++r) {
+            for(int c = c0; c <= c1; ++c) {
+                cells_[key(c, r)].push_back(window);
+            }
+        }
+    }
+
+private:
+    int cell(int coord) const
+    {
+        return coord >= 0 ? coord / cellSize_ : -((-coord - 1) / cellSize_) - 1;
+    }
+
+    void cellRange(const cv::Rect& window, int& c0, int& r0, int& c1, int& r1) const
+    {
+        c0 = cell(window.x);
+        r0 = cell(window.y);
+        c1 = cell(window.x + window.width - 1);
+        r1 = cell(window.y + window.height - 1);
+    }
+
+    static int64_t key(int c, int r)
+    {
+        return ((int64_t) r << 32) | (uint32_t) c;
+    }
+
+    const int cellSize_;
+    unordered_map<int64_t, vector<cv::Rect>> cells_;
+};
+
+} // namespace
+
+PredictionSpill::PredictionSpill(size_t topK, size_t memoryLimit, const string& scratchPath, bool scoreOrder) :
+    topK_(topK),
+    memoryLimit_(memoryLimit),
+    scratchPath_(scratchPath.empty() ? temp_directory_path().string() : scratchPath),
+    scoreOrder_(scoreOrder),
+    memory_(topK)
+{
+}
+
+PredictionSpill::~PredictionSpill()
+{
+    if(!spillDir_.empty()) {
+        boost::system::error_code ec;
+        remove_all(spillDir_, ec);
+    }
+}
+
+void PredictionSpill::append(PredictionStore& predictions)
+{
+    for(size_t i = 0; i < predictions.size(); ++i) {
+        auto window = predictions.window(i);
+        maxWindow_ = max(maxWindow_, max(window.width, window.height));
+    }
+
+    memory_.append(predictions);
+    size_ += predictions.size();
+    predictions.clear();
+
+    if(memoryLimit_ && memory_.bytes() > memoryLimit_) {
+        spill();
+    }
+}
+
+size_t PredictionSpill::size() const
+{
+    return size_;
+}
+
+size_t PredictionSpill::runs() const
+{
+    return runs_.size();
+}
+
+void PredictionSpill::forEach(const Consumer& consumer)
+{
+    PredictionStore batch(topK_);
+    for(const auto& run : runs_) {
+        ifstream ifs(run, std::ios::binary);
+        DG_CHECK(!ifs.fail(), "Error opening %s", run.c_str());
+
+        batch.clear();
+        while(batch.read(ifs, BATCH_ROWS)) {
+            consumer(batch);
+            batch.clear();
+        }
+    }
+
+    if(!memory_.empty()) {
+        if(scoreOrder_) {
+            memory_.sortByScore();
+        }
+        consumer(memory_);
+    }
+}
+
+void PredictionSpill::nonMaxSuppression(double overlapThreshold, const Consumer& consumer)
+{
+    DG_CHECK(scoreOrder_, "Non-maximum suppression requires predictions spilled in score order");
+
+    if(runs_.empty()) {
+        memory_.nonMaxSuppression(overlapThreshold);
+        if(!memory_.empty()) {
+            consumer(memory_);
+        }
+        return;
+    }
+
+    if(!memory_.empty()) {
+        spill();
+    }
+
+    // Merge the runs by descending score, ties go to the earlier run so the order matches a stable sort of all
+    // predictions, then keep every window that isn't suppressed by a previously kept one
+    vector<unique_ptr<RunReader>> readers;
+    for(const auto& run : runs_) {
+        readers.emplace_back(new RunReader(run, topK_));
+    }
+
+    auto lowerPriority = [&readers](size_t a, size_t b) {
+        auto scoreA = readers[a]->rows().score(readers[a]->row());
+        auto scoreB = readers[b]->rows().score(readers[b]->row());
+        return scoreA < scoreB || (scoreA == scoreB && a > b);
+    };
+
+    std::priority_queue<size_t, vector<size_t>, decltype(lowerPriority)> heads(lowerPriority);
+    for(size_t i = 0; i < readers.size(); ++i) {
+        if(!readers[i]->done()) {
+            heads.push(i);
+        }
+    }
+
+    WindowGrid kept(maxWindow_);
+    PredictionStore batch(topK_);
+    while(!heads.empty()) {
+        auto run = heads.top();
+        heads.pop();
+
+        auto& reader = *readers[run];
+
+        const auto& rows = reader.rows();
+        auto row = reader.row();
+        auto window = rows.window(row);
+        if(rows.numScores(row) && !kept.suppresses(window, overlapThreshold)) {
+            kept.add(window);
+
+            batch.append(rows, row);
+
+            if(batch.size() == BATCH_ROWS) {
+                consumer(batch);
+                batch.clear();
+            }
+        }
+
+        reader.next();
+        if(!reader.done()) {
+            heads.push(run);
+        }
+    }
+
+    if(!batch.empty()) {
+        consumer(batch);
+    }
+}
+
+void PredictionSpill::spill()
+{
+    if(spillDir_.empty()) {
+        spillDir_ = (path(scratchPath_) / unique_path("osn-predictions-%%%%-%%%%-%%%%")).string();
+        create_directories(spillDir_);
+        OSN_LOG(info) << "Predictions exceeded " << (memoryLimit_ >> 20) << " MB, spilling them to " << spillDir_;
+    }
+
+    if(scoreOrder_) {
+        memory_.sortByScore();
+    }
+
+    auto filePath = (format("%s/%d.run") % spillDir_ % runs_.size()).str();
+    ofstream ofs(filePath, std::ios::binary);
+    DG_CHECK(!ofs.fail(), "Error opening %s for writing", filePath.c_str());
+    memory_.write(ofs);
+    DG_CHECK(!ofs.fail(), "Error writing %s", filePath.c_str());
+
+    runs_.push_back(filePath);
+    memory_.clear();
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,71 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_PREDICTIONSPILL_H
+#define OPENSPACENET_PREDICTIONSPILL_H
+
+#include "PredictionStore.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace dg { namespace osn {
+
+//
+// Accumulates predictions up to a memory limit, past which they are written to runs in a scratch directory.
+// The predictions are streamed back to a consumer in batches, either as they were appended or reduced by
+// non-maximum suppression, which then keeps only the retained windows in memory.
+//
+class PredictionSpill
+{
+public:
+    typedef std::function<void(const PredictionStore&)> Consumer;
+
+    // A memory limit of 0 means predictions are never spilled. With scoreOrder the runs are sorted by descending
+    // score, which nonMaxSuppression() requires.
+    PredictionSpill(size_t topK, size_t memoryLimit, const std::string& scratchPath, bool scoreOrder);
+    ~PredictionSpill();
+
+    // Moves the rows of predictions into the spill, leaving predictions empty
+    void append(PredictionStore& predictions);
+
+    size_t size() const;
+    size_t runs() const;
+
+    // Streams all predictions in run order, which is the order they were appended in unless created with scoreOrder
+    void forEach(const Consumer& consumer);
+
+    // Streams the same rows, in the same order, as PredictionStore::nonMaxSuppression() over all predictions
+    void nonMaxSuppression(double overlapThreshold, const Consumer& consumer);
+
+private:
+    void spill();
+
+    const size_t topK_;
+    const size_t memoryLimit_;
+    const std::string scratchPath_;
+    const bool scoreOrder_;
+    std::string spillDir_;
+
+    PredictionStore memory_;
+    std::vector<std::string> runs_;
+    size_t size_ = 0;
+    int maxWindow_ = 1;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_PREDICTIONSPILL_H
@@ -0,0 +1,370 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "PredictionStore.h"
+
+#include <algorithm>
+#include <istream>
+#include <limits>
+#include <numeric>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using dg::deepcore::classification::WindowPrediction;
+using std::istream;
+using std::max;
+using std::min;
+using std::numeric_limits;
+using std::ostream;
+using std::vector;
+
+bool overlaps(const cv::Rect& kept, const cv::Rect& candidate, double overlapThreshold)
+{
+    double intersection = (kept & candidate).area();
+    return intersection > overlapThreshold * (kept.area() + candidate.area() - intersection);
+}
+
+PredictionStore::PredictionStore(size_t topK) :
+    topK_(topK)
+{
+    DG_CHECK(topK_ <= numeric_limits<uint16_t>::max(), "Invalid number of top predictions: %d", (int) topK_);
+}
+
+void PredictionStore::append(const cv::Rect& window, const ClassScore* scores, size_t count)
+{
+    count = min(count, (size_t) numeric_limits<uint16_t>::max());
+    if(topK_) {
+        count = min(count, topK_);
+    }
+
+    x_.push_back(window.x);
+    y_.push_back(window.y);
+    width_.push_back(window.width);
+    height_.push_back(window.height);
+    first_.push_back(classIds_.size());
+    count_.push_back((uint16_t) count);
+
+    for(size_t k = 0; k < count; ++k) {
+        classIds_.push_back(scores[k].classId);
+        scores_.push_back(scores[k].score);
+    }
+}
+
+void PredictionStore::append(const LabelTable& labels, const vector<WindowPrediction>& predictions,
+                             const vector<bool>& keep)
+{
+    reserve(size() + predictions.size());
+
+    vector<ClassScore> scores;
+    for(const auto& prediction : predictions) {
+        scores.clear();
+        for(const auto& p : prediction.predictions) {
+            if(topK_ && scores.size() == topK_) {
+                break;
+            }
+
+            auto id = labels.id(p.label);
+            if(keep.empty() || keep[id]) {
+                scores.push_back({ id, p.confidence });
+            }
+        }
+
+        append(prediction.window, scores.data(), scores.size());
+    }
+}
+
+void PredictionStore::append(const PredictionStore& other)
+{
+    DG_CHECK(other.topK_ == topK_, "Prediction stores have different top prediction counts");
+
+    auto shift = classIds_.size();
+    x_.insert(x_.end(), other.x_.begin(), other.x_.end());
+    y_.insert(y_.end(), other.y_.begin(), other.y_.end());
+    width_.insert(width_.end(), other.width_.begin(), other.width_.end());
+    height_.insert(height_.end(), other.height_.begin(), other.height_.end());
+    for(auto first : other.first_) {
+        first_.push_back(first + shift);
+    }
+    count_.insert(count_.end(), other.count_.begin(), other.count_.end());
+    classIds_.insert(classIds_.end(), other.classIds_.begin(), other.classIds_.end());
+    scores_.insert(scores_.end(), other.scores_.begin(), other.scores_.end());
+}
+
+void PredictionStore::append(const PredictionStore& other, size_t row)
+{
+    x_.push_back(other.x_[row]);
+    y_.push_back(other.y_[row]);
+    width_.push_back(other.width_[row]);
+    height_.push_back(other.height_[row]);
+    first_.push_back(classIds_.size());
+    count_.push_back(other.count_[row]);
+
+    auto first = other.first_[row];
+    auto last = first + other.count_[row];
+    classIds_.insert(classIds_.end(), other.classIds_.begin() + first, other.classIds_.begin() + last);
+    scores_.insert(scores_.end(), other.scores_.begin() + first, other.scores_.begin() + last);
+}
+
+void PredictionStore::reserve(size_t rows)
+{
+    x_.reserve(rows);
+    y_.reserve(rows);
+    width_.reserve(rows);
+    height_.reserve(rows);
+    first_.reserve(rows);
+    count_.reserve(rows);
+}
+
+void PredictionStore::clear()
+{
+    x_.clear();
+    y_.clear();
+    width_.clear();
+    height_.clear();
+    first_.clear();
+    count_.clear();
+    classIds_.clear();
+    scores_.clear();
+}
+
+size_t PredictionStore::size() const
+{
+    return x_.size();
+}
+
+bool PredictionStore::empty() const
+{
+    return x_.empty();
+}
+
+size_t PredictionStore::topK() const
+{
+    return topK_;
+}
+
+size_t PredictionStore::bytes() const
+{
+    return size() * (4 * sizeof(int32_t) + sizeof(size_t) + sizeof(uint16_t)) +
+           classIds_.size() * (sizeof(ClassId) + sizeof(float));
+}
+
+cv::Rect PredictionStore::window(size_t row) const
+{
+    return { x_[row], y_[row], width_[row], height_[row] };
+}
+
+ClassId PredictionStore::classId(size_t row) const
+{
+    return count_[row] ? classIds_[first_[row]] : 0;
+}
+
+float PredictionStore::score(size_t row) const
+{
+    return count_[row] ? scores_[first_[row]] : 0.0F;
+}
+
+size_t PredictionStore::numScores(size_t row) const
+{
+    return count_[row];
+}
+
+ClassScore PredictionStore::prediction(size_t row, size_t k) const
+{
+    return { classIds_[first_[row] + k], scores_[first_[row] + k] };
+}
+
+void PredictionStore::offset(const cv::Point& offset, size_t first)
+{
+    for(size_t i = first; i < x_.size(); ++i) {
+        x_[i] += offset.x;
+    }
+
+    for(size_t i = first; i < y_.size(); ++i) {
+        y_[i] += offset.y;
+    }
+}
+
+void PredictionStore::sortByScore()
+{
+    vector<size_t> order(size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return score(a) > score(b);
+    });
+
+    keepRows(order);
+}
+
+void PredictionStore::write(ostream& os) const
+{
+    for(size_t i = 0; i < size(); ++i) {
+        const int32_t window[] = { x_[i], y_[i], width_[i], height_[i] };
+        os.write((const char*) window, sizeof(window));
+        os.write((const char*) &count_[i], sizeof(uint16_t));
+        os.write((const char*) (classIds_.data() + first_[i]), count_[i] * sizeof(ClassId));
+        os.write((const char*) (scores_.data() + first_[i]), count_[i] * sizeof(float));
+    }
+}
+
+size_t PredictionStore::read(istream& is, size_t maxRows)
+{
+    size_t rows = 0;
+    int32_t window[4];
+    uint16_t count;
+    vector<ClassId> classIds;
+    vector<float> scores;
+
+    for(; rows < maxRows; ++rows) {
+        is.read((char*) window, sizeof(window));
+        is.read((char*) &count, sizeof(count));
+        classIds.resize(count);
+        scores.resize(count);
+        is.read((char*) classIds.data(), count * sizeof(ClassId));
+        is.read((char*) scores.data(), count * sizeof(float));
+        if(!is) {
+            break;
+        }
+
+        x_.push_back(window[0]);
+        y_.push_back(window[1]);
+        width_.push_back(window[2]);
+        height_.push_back(window[3]);
+        first_.push_back(classIds_.size());
+        count_.push_back(count);
+        classIds_.insert(classIds_.end(), classIds.begin(), classIds.end());
+        scores_.insert(scores_.end(), scores.begin(), scores.end());
+    }
+
+    return rows;
+}
+
+void PredictionStore::nonMaxSuppression(double overlapThreshold)
+{
+    vector<size_t> order;
+    order.reserve(size());
+    for(size_t i = 0; i < size(); ++i) {
+        if(count_[i]) {
+            order.push_back(i);
+        }
+    }
+
+    if(order.empty()) {
+        clear();
+        return;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return score(a) > score(b);
+    });
+
+    vector<size_t> rank(size());
+    for(size_t r = 0; r < order.size(); ++r) {
+        rank[order[r]] = r;
+    }
+
+    // Bucket the windows into a uniform grid no finer than the largest window, so each window only gets compared
+    // against its neighbors. The grid is stored as one index array with per-cell offsets.
+    int minX = numeric_limits<int>::max(), minY = numeric_limits<int>::max();
+    int maxX = numeric_limits<int>::min(), maxY = numeric_limits<int>::min();
+    int cellSize = 1;
+    for(auto i : order) {
+        minX = min(minX, x_[i]);
+        minY = min(minY, y_[i]);
+        maxX = max(maxX, x_[i] + width_[i]);
+        maxY = max(maxY, y_[i] + height_[i]);
+        cellSize = max(cellSize, max(width_[i], height_[i]));
+    }
+
+    int cols = (maxX - minX) / cellSize + 1;
+    int rows = (maxY - minY) / cellSize + 1;
+
+    auto cellRange = [&](size_t i, int& c0, int& r0, int& c1, int& r1) {
+        c0 = (x_[i] - minX) / cellSize;
+        r0 = (y_[i] - minY) / cellSize;
+        c1 = (x_[i] + width_[i] - 1 - minX) / cellSize;
+        r1 = (y_[i] + height_[i] - 1 - minY) / cellSize;
+    };
+
+    vector<size_t> cellStart((size_t) cols * rows + 1, 0);
+    for(auto i : order) {
+        int c0, r0, c1, r1;
+        cellRange(i, c0, r0, c1, r1);
+        for(int r = r0; r <= r1; ++r) {
+            for(int c = c0; c <= c1; ++c) {
+                ++cellStart[(size_t) r * cols + c + 1];
+            }
+        }
+    }
+    std::partial_sum(cellStart.begin(), cellStart.end(), cellStart.begin());
+
+    vector<size_t> cells(cellStart.back());
+    auto cellFill = cellStart;
+    for(auto i : order) {
+        int c0, r0, c1, r1;
+        cellRange(i, c0, r0, c1, r1);
+        for(int r = r0; r <= r1; ++r) {
+            for(int c = c0; c <= c1; ++c) {
+                cells[cellFill[(size_t) r * cols + c]++] = i;
+            }
+        }
+    }
+
+    vector<bool> suppressed(size(), false);
+    vector<size_t> kept;
+    for(auto i : order) {
+        if(suppressed[i]) {
+            continue;
+        }
+
+        kept.push_back(i);
+
+        auto keptWindow = window(i);
+        int c0, r0, c1, r1;
+        cellRange(i, c0, r0, c1, r1);
+        for(int r = r0; r <= r1; ++r) {
+            for(int c = c0; c <= c1; ++c) {
+                auto cell = (size_t) r * cols + c;
+                for(auto idx = cellStart[cell]; idx < cellStart[cell + 1]; ++idx) {
+                    auto j = cells[idx];
+                    if(suppressed[j] || rank[j] <= rank[i]) {
+                        continue;
+                    }
+
+                    if(overlaps(keptWindow, window(j), overlapThreshold)) {
+                        suppressed[j] = true;
+                    }
+                }
+            }
+        }
+    }
+
+    keepRows(kept);
+}
+
+void PredictionStore::keepRows(const vector<size_t>& rows)
+{
+    PredictionStore kept(topK_);
+    kept.reserve(rows.size());
+
+    for(auto row : rows) {
+        kept.append(*this, row);
+    }
+
+    *this = std::move(kept);
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,101 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_PREDICTIONSTORE_H
+#define OPENSPACENET_PREDICTIONSTORE_H
+
+#include "ClassPrediction.h"
+#include <classification/Prediction.h>
+#include <cstdint>
+#include <iosfwd>
+#include <opencv2/core/types.hpp>
+#include <vector>
+
+namespace dg { namespace osn {
+
+// Whether candidate is suppressed by the retained window kept, their intersection over union is more than
+// overlapThreshold. This is the overlap measure of DeepCore's non-maximum suppression.
+bool overlaps(const cv::Rect& kept, const cv::Rect& candidate, double overlapThreshold);
+
+//
+// Structure-of-arrays store of window predictions. Each row is a window rectangle with its class scores sorted by
+// descending score. The scores of all rows share two flat columns, each row refers to its range with a first index
+// and a count, so the store never allocates per prediction and rows only take the space of the classes they have.
+// A topK other than 0 keeps only that many of the top classes.
+//
+class PredictionStore
+{
+public:
+    explicit PredictionStore(size_t topK = 0);
+
+    void append(const cv::Rect& window, const ClassScore* scores, size_t count);
+
+    // Classes not set in a non-empty keep are left out before the top scores are taken. Like DeepCore's
+    // filterLabels(), windows without any classes left are still appended, they are skipped by non-maximum
+    // suppression and in the output.
+    void append(const LabelTable& labels, const std::vector<deepcore::classification::WindowPrediction>& predictions,
+                const std::vector<bool>& keep = {});
+
+    void append(const PredictionStore& other);
+    void append(const PredictionStore& other, size_t row);
+    void reserve(size_t rows);
+    void clear();
+
+    size_t size() const;
+    bool empty() const;
+    size_t topK() const;
+
+    // Approximate memory used by the rows
+    size_t bytes() const;
+
+    cv::Rect window(size_t row) const;
+    ClassId classId(size_t row) const;
+    float score(size_t row) const;
+    size_t numScores(size_t row) const;
+    ClassScore prediction(size_t row, size_t k) const;
+
+    // Shifts the windows in rows [first, size()) by offset
+    void offset(const cv::Point& offset, size_t first = 0);
+
+    // Stable sort of the rows by descending top score
+    void sortByScore();
+
+    // Writes the rows in a flat binary layout, read() appends up to maxRows rows and returns the number read
+    void write(std::ostream& os) const;
+    size_t read(std::istream& is, size_t maxRows);
+
+    // Greedy non-maximum suppression by top score, like DeepCore's, a window is suppressed when its intersection over
+    // union with a retained window is more than overlapThreshold. Rows without classes are removed, the retained rows
+    // are ordered by descending score.
+    void nonMaxSuppression(double overlapThreshold);
+
+private:
+    void keepRows(const std::vector<size_t>& rows);
+
+    size_t topK_;
+    std::vector<int32_t> x_;
+    std::vector<int32_t> y_;
+    std::vector<int32_t> width_;
+    std::vector<int32_t> height_;
+    std::vector<size_t> first_;
+    std::vector<uint16_t> count_;
+    std::vector<ClassId> classIds_;
+    std::vector<float> scores_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_PREDICTIONSTORE_H
@@ -0,0 +1,168 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "RateLimiter.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+using std::string;
+
+// Marks an initialized shared file, "OSNRATE1"
+static const uint64_t BUCKETS_MAGIC = 0x4f534e5241544531;
+
+// The monotonic clock is system wide, so processes sharing the buckets agree on it
+static int64_t now()
+{
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+RateLimiter::RateLimiter(double requestsPerSecond, double bytesPerSecond, const string& sharedPath) :
+    requestsPerSecond_(requestsPerSecond),
+    bytesPerSecond_(bytesPerSecond),
+    local_({ BUCKETS_MAGIC, max(1.0, requestsPerSecond), bytesPerSecond, now() }),
+    buckets_(&local_),
+    waited_(0)
+{
+    if(sharedPath.empty()) {
+        return;
+    }
+
+    fd_ = open(sharedPath.c_str(), O_RDWR | O_CREAT, 0666);
+    DG_CHECK(fd_ >= 0, "Error opening %s", sharedPath.c_str());
+
+    // Whoever gets the lock first on a new file initializes it
+    flock(fd_, LOCK_EX);
+    struct stat st;
+    void* mapped = MAP_FAILED;
+    if(!fstat(fd_, &st) && (st.st_size >= (off_t) sizeof(Buckets) || !ftruncate(fd_, sizeof(Buckets)))) {
+        mapped = mmap(nullptr, sizeof(Buckets), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    }
+
+    if(mapped == MAP_FAILED) {
+        flock(fd_, LOCK_UN);
+        close(fd_);
+        DG_ERROR_THROW("Error mapping %s", sharedPath.c_str());
+    }
+
+    buckets_ = static_cast<Buckets*>(mapped);
+    if(buckets_->magic != BUCKETS_MAGIC) {
+        *buckets_ = local_;
+    }
+    flock(fd_, LOCK_UN);
+}
+
+RateLimiter::~RateLimiter()
+{
+    if(fd_ >= 0) {
+        munmap(buckets_, sizeof(Buckets));
+        close(fd_);
+    }
+}
+
+void RateLimiter::acquire()
+{
+    if(requestsPerSecond_ <= 0 && bytesPerSecond_ <= 0) {
+        return;
+    }
+
+    auto startTime = steady_clock::now();
+    for(;;) {
+        double wait = 0;
+        update([this, &wait](Buckets& buckets) {
+            if(requestsPerSecond_ > 0 && buckets.requests < 1) {
+                wait = (1 - buckets.requests) / requestsPerSecond_;
+            }
+            if(bytesPerSecond_ > 0 && buckets.bytes < 0) {
+                wait = max(wait, -buckets.bytes / bytesPerSecond_);
+            }
+            if(wait <= 0 && requestsPerSecond_ > 0) {
+                buckets.requests -= 1;
+            }
+        });
+
+        if(wait <= 0) {
+            break;
+        }
+
+        // Other threads and processes draw from the same buckets, so the tokens are claimed again after waking up
+        std::this_thread::sleep_for(duration<double>(wait));
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    waited_ += steady_clock::now() - startTime;
+}
+
+void RateLimiter::consume(size_t bytes)
+{
+    if(bytesPerSecond_ <= 0) {
+        return;
+    }
+
+    update([bytes](Buckets& buckets) {
+        buckets.bytes -= bytes;
+    });
+}
+
+duration<double> RateLimiter::waited() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return waited_;
+}
+
+void RateLimiter::update(const std::function<void(Buckets&)>& func)
+{
+    // flock only excludes other processes, the threads of this one share the descriptor
+    lock_guard<mutex> lock(mutex_);
+    if(fd_ >= 0) {
+        flock(fd_, LOCK_EX);
+    }
+
+    auto& buckets = *buckets_;
+    auto updated = now();
+    auto elapsed = max(0.0, (updated - buckets.updated) * 1e-9);
+    if(requestsPerSecond_ > 0) {
+        buckets.requests = min(max(1.0, requestsPerSecond_), buckets.requests + elapsed * requestsPerSecond_);
+    }
+    if(bytesPerSecond_ > 0) {
+        buckets.bytes = min(bytesPerSecond_, buckets.bytes + elapsed * bytesPerSecond_);
+    }
+    buckets.updated = updated;
+
+    func(buckets);
+
+    if(fd_ >= 0) {
+        flock(fd_, LOCK_UN);
+    }
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,76 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_RATELIMITER_H
+#define OPENSPACENET_RATELIMITER_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace dg { namespace osn {
+
+//
+// Token buckets limiting service requests and downloaded bytes per second, each holding up to one second worth of
+// tokens. Bytes are only known once a response arrives, so they are charged afterwards and the byte bucket may go
+// into debt, which holds back the following requests.
+//
+// With a shared path, the buckets live in that file instead of in memory, so every process using the same file
+// draws from the same budget. Those processes should use the same limits.
+//
+class RateLimiter
+{
+public:
+    // A zero rate is unlimited
+    RateLimiter(double requestsPerSecond, double bytesPerSecond, const std::string& sharedPath = "");
+    ~RateLimiter();
+
+    // Waits until a request may be made, and takes its token
+    void acquire();
+
+    // Charges the bytes of a response
+    void consume(size_t bytes);
+
+    // Total time spent waiting in acquire()
+    std::chrono::duration<double> waited() const;
+
+private:
+    struct Buckets
+    {
+        uint64_t magic;
+        double requests;
+        double bytes;
+        int64_t updated;
+    };
+
+    // Refills the buckets and calls func with them, holding the locks
+    void update(const std::function<void(Buckets&)>& func);
+
+    const double requestsPerSecond_;
+    const double bytesPerSecond_;
+
+    mutable std::mutex mutex_;
+    Buckets local_;
+    Buckets* buckets_;
+    int fd_ = -1;
+    std::chrono::duration<double> waited_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_RATELIMITER_H
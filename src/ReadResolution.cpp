@@ -0,0 +1,220 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "ReadResolution.h"
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <cmath>
+#include <cpl_string.h>
+#include <cpl_vsi.h>
+#include <gdal.h>
+#include <gdal_utils.h>
+#include <ogr_srs_api.h>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using boost::lexical_cast;
+using std::max;
+using std::min;
+using std::string;
+
+// Equatorial circumference of the web mercator sphere, in meters
+static const double EARTH_CIRCUMFERENCE = 40075016.686;
+
+static const int TILE_SIZE = 256;
+static const int MAX_ZOOM = 22;
+
+// Reducing by less than this isn't worth resampling for
+static const double MIN_FACTOR = 1.05;
+
+static double toRadians(double degrees)
+{
+    return degrees * M_PI / 180;
+}
+
+double zoomGsd(int zoom, double latitude)
+{
+    return EARTH_CIRCUMFERENCE / TILE_SIZE * std::cos(toRadians(latitude)) / std::ldexp(1.0, zoom);
+}
+
+int zoomForGsd(double gsd, double latitude)
+{
+    DG_CHECK(gsd > 0, "Invalid ground sample distance");
+
+    // Each zoom level halves the ground sample distance, so the closest one is the closest on a log scale
+    auto zoom = (int) std::lround(std::log2(zoomGsd(0, latitude) / gsd));
+    return max(0, min(MAX_ZOOM, zoom));
+}
+
+// Ground sample distance at the center of the dataset in meters, 0 if it can't be measured. The latitude of the
+// center is stored when it's known.
+static double measureGsd(GDALDatasetH dataset, double* latitude = nullptr)
+{
+    double geoTransform[6];
+    auto wkt = GDALGetProjectionRef(dataset);
+    if(GDALGetGeoTransform(dataset, geoTransform) != CE_None || !wkt || !*wkt) {
+        return 0;
+    }
+
+    auto sr = OSRNewSpatialReference(wkt);
+    if(!sr) {
+        return 0;
+    }
+
+    auto centerX = GDALGetRasterXSize(dataset) / 2.0;
+    auto centerY = GDALGetRasterYSize(dataset) / 2.0;
+    double x = geoTransform[0] + geoTransform[1] * centerX + geoTransform[2] * centerY;
+    double y = geoTransform[3] + geoTransform[4] * centerX + geoTransform[5] * centerY;
+    auto pixelWidth = std::hypot(geoTransform[1], geoTransform[4]);
+    auto pixelHeight = std::hypot(geoTransform[2], geoTransform[5]);
+
+    double gsd = 0;
+    if(OSRIsGeographic(sr)) {
+        // A degree of longitude shrinks with the latitude, a degree of latitude doesn't
+        auto metersPerDegree = EARTH_CIRCUMFERENCE / 360;
+        gsd = std::sqrt(pixelWidth * std::cos(toRadians(y)) * pixelHeight) * metersPerDegree;
+        if(latitude) {
+            *latitude = y;
+        }
+    } else if(OSRIsProjected(sr)) {
+        gsd = std::sqrt(pixelWidth * pixelHeight) * OSRGetLinearUnits(sr, nullptr);
+
+        auto geographic = OSRCloneGeogCS(sr);
+#if GDAL_VERSION_NUM >= 3000000
+        OSRSetAxisMappingStrategy(sr, OAMS_TRADITIONAL_GIS_ORDER);
+        OSRSetAxisMappingStrategy(geographic, OAMS_TRADITIONAL_GIS_ORDER);
+#endif
+        auto toGeographic = OCTNewCoordinateTransformation(sr, geographic);
+        auto projected = toGeographic && OCTTransform(toGeographic, 1, &x, &y, nullptr);
+        if(projected && latitude) {
+            *latitude = y;
+        }
+
+        // Mercator units are only true to scale at the equator
+        auto projection = OSRGetAttrValue(sr, "PROJECTION", 0);
+        if(projection && string(projection).find("Mercator") != string::npos) {
+            gsd = projected ? gsd * std::cos(toRadians(y)) : 0;
+        }
+
+        if(toGeographic) {
+            OCTDestroyCoordinateTransformation(toGeographic);
+        }
+        OSRDestroySpatialReference(geographic);
+    }
+
+    OSRDestroySpatialReference(sr);
+    return gsd;
+}
+
+int imageZoom(const string& path)
+{
+    GDALAllRegister();
+    auto dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+    DG_CHECK(dataset, "Error opening %s", path.c_str());
+
+    double latitude = NAN;
+    auto gsd = measureGsd(dataset, &latitude);
+    GDALClose(dataset);
+
+    return gsd > 0 && !std::isnan(latitude) ? zoomForGsd(gsd, latitude) : -1;
+}
+
+ReducedImage::ReducedImage(const string& path, double gsd) :
+    path_(path)
+{
+    GDALAllRegister();
+    auto dataset = GDALOpen(path.c_str(), GA_ReadOnly);
+    DG_CHECK(dataset, "Error opening %s", path.c_str());
+
+    nativeGsd_ = measureGsd(dataset);
+    if(nativeGsd_ <= 0 || gsd / nativeGsd_ < MIN_FACTOR) {
+        GDALClose(dataset);
+        return;
+    }
+
+    auto factor = gsd / nativeGsd_;
+    auto fullWidth = GDALGetRasterXSize(dataset);
+    auto fullHeight = GDALGetRasterYSize(dataset);
+    auto width = max(1L, std::lround(fullWidth / factor));
+    auto height = max(1L, std::lround(fullHeight / factor));
+
+    // Averaging keeps the reduced pixels close to what a sensor at the coarser resolution would record
+    char** argv = nullptr;
+    argv = CSLAddString(argv, "-of");
+    argv = CSLAddString(argv, "VRT");
+    argv = CSLAddString(argv, "-outsize");
+    argv = CSLAddString(argv, lexical_cast<string>(width).c_str());
+    argv = CSLAddString(argv, lexical_cast<string>(height).c_str());
+    argv = CSLAddString(argv, "-r");
+    argv = CSLAddString(argv, "average");
+    auto options = GDALTranslateOptionsNew(argv, nullptr);
+    CSLDestroy(argv);
+
+    vrtPath_ = "/vsimem/osn-reduced-" + lexical_cast<string>(this) + ".vrt";
+    auto vrt = GDALTranslate(vrtPath_.c_str(), dataset, options, nullptr);
+    GDALTranslateOptionsFree(options);
+    GDALClose(dataset);
+
+    if(!vrt) {
+        VSIUnlink(vrtPath_.c_str());
+        DG_ERROR_THROW("Error reducing %s to %g m", path.c_str(), gsd);
+    }
+
+    // Closing writes the VRT out
+    GDALClose(vrt);
+    path_ = vrtPath_;
+
+    // The sizes are rounded, the pixels of the reduced image cover the original one by their ratio and not exactly by
+    // the requested factor
+    xFactor_ = (double) fullWidth / width;
+    yFactor_ = (double) fullHeight / height;
+}
+
+ReducedImage::~ReducedImage()
+{
+    if(!vrtPath_.empty()) {
+        VSIUnlink(vrtPath_.c_str());
+    }
+}
+
+const string& ReducedImage::path() const
+{
+    return path_;
+}
+
+double ReducedImage::nativeGsd() const
+{
+    return nativeGsd_;
+}
+
+bool ReducedImage::reduced() const
+{
+    return !vrtPath_.empty();
+}
+
+double ReducedImage::xFactor() const
+{
+    return xFactor_;
+}
+
+double ReducedImage::yFactor() const
+{
+    return yFactor_;
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,66 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_READRESOLUTION_H
+#define OPENSPACENET_READRESOLUTION_H
+
+#include <string>
+
+namespace dg { namespace osn {
+
+// Web mercator zoom level whose ground sample distance at latitude is closest to gsd, in meters per pixel
+int zoomForGsd(double gsd, double latitude);
+
+// Ground sample distance of a web mercator zoom level at latitude
+double zoomGsd(int zoom, double latitude);
+
+// Web mercator zoom level closest to the resolution of the image at path, -1 if it's unknown
+int imageZoom(const std::string& path);
+
+//
+// A local image read at a coarser ground sample distance. The image is wrapped in an in-memory VRT of the reduced
+// size, GDAL then reads it from the overviews when the image has them, or decimates while reading. Images already at
+// the target resolution or coarser, and images without a usable ground sample distance, are read as they are.
+//
+class ReducedImage
+{
+public:
+    ReducedImage(const std::string& path, double gsd);
+    ~ReducedImage();
+
+    // The path to open, either the VRT or the original image
+    const std::string& path() const;
+
+    // Native ground sample distance in meters, 0 if it's unknown
+    double nativeGsd() const;
+
+    // Whether the image is read reduced, and by how much along each axis, i.e. the original raster size over the
+    // reduced one
+    bool reduced() const;
+    double xFactor() const;
+    double yFactor() const;
+
+private:
+    std::string path_;
+    std::string vrtPath_;
+    double nativeGsd_ = 0;
+    double xFactor_ = 1;
+    double yFactor_ = 1;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_READRESOLUTION_H
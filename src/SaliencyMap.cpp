@@ -0,0 +1,107 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "SaliencyMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using std::max;
+using std::min;
+using std::numeric_limits;
+
+// Cell rows converted at a time, so the float copies stay small even for a whole AOI
+static const int STRIP_CELLS = 64;
+
+SaliencyMap::SaliencyMap(const cv::Mat& image, int cellSize) :
+    cellSize_(cellSize)
+{
+    DG_CHECK(cellSize_ > 0, "Invalid saliency cell size: %d", cellSize_);
+
+    cv::Size cells(image.cols / cellSize_, image.rows / cellSize_);
+    if(!cells.area()) {
+        return;
+    }
+
+    cv::Mat mean(cells, CV_32F);
+    cv::Mat sqMean(cells, CV_32F);
+    for(int cellRow = 0; cellRow < cells.height; cellRow += STRIP_CELLS) {
+        auto stripCells = min(STRIP_CELLS, cells.height - cellRow);
+        cv::Rect strip(0, cellRow * cellSize_, cells.width * cellSize_, stripCells * cellSize_);
+        addStrip(image(strip), cellRow, mean, sqMean);
+    }
+
+    cv::integral(mean, sum_, CV_64F);
+    cv::integral(sqMean, sqSum_, CV_64F);
+}
+
+double SaliencyMap::stdDev(const cv::Rect& window) const
+{
+    if(sum_.empty()) {
+        return numeric_limits<double>::infinity();
+    }
+
+    auto toCell = [this](int coord, int limit) {
+        return max(0, min(limit, (coord + cellSize_ / 2) / cellSize_));
+    };
+
+    auto c0 = toCell(window.x, sum_.cols - 1);
+    auto r0 = toCell(window.y, sum_.rows - 1);
+    auto c1 = toCell(window.x + window.width, sum_.cols - 1);
+    auto r1 = toCell(window.y + window.height, sum_.rows - 1);
+    if(c1 <= c0 || r1 <= r0) {
+        return numeric_limits<double>::infinity();
+    }
+
+    auto total = [=](const cv::Mat& integral) {
+        return integral.at<double>(r1, c1) - integral.at<double>(r0, c1) -
+               integral.at<double>(r1, c0) + integral.at<double>(r0, c0);
+    };
+
+    double count = (c1 - c0) * (r1 - r0);
+    auto mean = total(sum_) / count;
+    auto variance = total(sqSum_) / count - mean * mean;
+    return std::sqrt(max(variance, 0.0));
+}
+
+void SaliencyMap::addStrip(const cv::Mat& strip, int cellRow, cv::Mat& mean, cv::Mat& sqMean) const
+{
+    cv::Mat pixels;
+    strip.convertTo(pixels, CV_32F);
+
+    cv::Mat gray;
+    if(pixels.channels() > 1) {
+        cv::Mat weights(1, pixels.channels(), CV_32F, cv::Scalar(1.0 / pixels.channels()));
+        cv::transform(pixels, gray, weights);
+    } else {
+        gray = pixels;
+    }
+
+    cv::Size cells(strip.cols / cellSize_, strip.rows / cellSize_);
+    cv::Mat meanCells = mean.rowRange(cellRow, cellRow + cells.height);
+    cv::Mat sqMeanCells = sqMean.rowRange(cellRow, cellRow + cells.height);
+
+    // Area interpolation with an integer scale averages each cell exactly
+    cv::resize(gray, meanCells, cells, 0, 0, cv::INTER_AREA);
+    cv::resize(gray.mul(gray), sqMeanCells, cells, 0, 0, cv::INTER_AREA);
+}
+
+} } // namespace dg { namespace osn {
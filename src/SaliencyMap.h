@@ -0,0 +1,47 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_SALIENCYMAP_H
+#define OPENSPACENET_SALIENCYMAP_H
+
+#include <opencv2/core/core.hpp>
+
+namespace dg { namespace osn {
+
+//
+// Texture measure for windows of an image. The image is averaged over its bands and into square cells, and integral
+// images of the cell means and squared values give the standard deviation of any window in constant time. Window
+// edges are rounded to the nearest cell, so the result is exact for windows aligned to the cell grid.
+//
+class SaliencyMap
+{
+public:
+    explicit SaliencyMap(const cv::Mat& image, int cellSize = 4);
+
+    // Standard deviation of the band-averaged pixel values in window, in the units of the image
+    double stdDev(const cv::Rect& window) const;
+
+private:
+    void addStrip(const cv::Mat& strip, int cellRow, cv::Mat& mean, cv::Mat& sqMean) const;
+
+    const int cellSize_;
+    cv::Mat sum_;
+    cv::Mat sqSum_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_SALIENCYMAP_H
@@ -0,0 +1,158 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "SuperBlockReader.h"
+
+#include <algorithm>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+using std::pair;
+using std::vector;
+
+// Super-blocks are no larger than this in either dimension, rounded up to the window size
+static const int MAX_SUPER_BLOCK_SIZE = 2048;
+
+static int roundUp(int value, int multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+static int ceilDiv(int value, int divisor)
+{
+    return (value + divisor - 1) / divisor;
+}
+
+SuperBlockReader::SuperBlockReader(const cv::Size& imageSize, const cv::Size& nativeBlockSize,
+                                   const cv::Size& windowSize, BlockFunc func, const BlockBufferPool* pool) :
+    imageSize_(imageSize),
+    nativeBlockSize_(nativeBlockSize),
+    blockSize_(superBlockSize(nativeBlockSize, windowSize)),
+    numBlocks_(ceilDiv(imageSize.width, blockSize_.width), ceilDiv(imageSize.height, blockSize_.height)),
+    func_(std::move(func)),
+    pool_(pool)
+{
+}
+
+cv::Size SuperBlockReader::superBlockSize(const cv::Size& nativeBlockSize, const cv::Size& windowSize)
+{
+    DG_CHECK(windowSize.width > 0 && windowSize.height > 0, "Invalid window size");
+
+    return { roundUp(max(1, min(nativeBlockSize.width, MAX_SUPER_BLOCK_SIZE)), windowSize.width),
+             roundUp(max(1, min(nativeBlockSize.height, MAX_SUPER_BLOCK_SIZE)), windowSize.height) };
+}
+
+bool SuperBlockReader::add(const cv::Point& origin, cv::Mat&& block)
+{
+    auto nativeRect = cv::Rect(origin, block.size()) & cv::Rect({ 0, 0 }, imageSize_);
+    if(!nativeRect.area()) {
+        return true;
+    }
+
+    struct Target
+    {
+        Key key;
+        cv::Rect rect;
+        cv::Mat block;
+    };
+
+    int col0 = nativeRect.x / blockSize_.width;
+    int col1 = (nativeRect.br().x - 1) / blockSize_.width;
+    int row0 = nativeRect.y / blockSize_.height;
+    int row1 = (nativeRect.br().y - 1) / blockSize_.height;
+
+    vector<Target> targets;
+    {
+        lock_guard<mutex> lock(mutex_);
+        for(int row = row0; row <= row1; ++row) {
+            for(int col = col0; col <= col1; ++col) {
+                Key key(row, col);
+                auto rect = superBlockRect(col, row);
+                auto it = assemblies_.find(key);
+                if(it == assemblies_.end()) {
+                    Assembly assembly { pool_ ? pool_->newMat() : cv::Mat(), nativeBlocksIn(rect) };
+                    assembly.block.create(rect.size(), block.type());
+                    it = assemblies_.emplace(key, std::move(assembly)).first;
+                }
+                targets.push_back({ key, rect, it->second.block });
+            }
+        }
+    }
+
+    // Native blocks don't overlap, so the copies never touch the same pixels and can run unlocked
+    for(auto& target : targets) {
+        auto overlap = nativeRect & target.rect;
+        block(overlap - origin).copyTo(target.block(overlap - target.rect.tl()));
+        target.block.release();
+    }
+    block.release();
+
+    vector<pair<cv::Point, cv::Mat>> completed;
+    {
+        lock_guard<mutex> lock(mutex_);
+        for(const auto& target : targets) {
+            auto it = assemblies_.find(target.key);
+            if(!--it->second.remaining) {
+                completed.emplace_back(target.rect.tl(), std::move(it->second.block));
+                assemblies_.erase(it);
+            }
+        }
+    }
+
+    for(auto& superBlock : completed) {
+        if(!func_(superBlock.first, std::move(superBlock.second))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+const cv::Size& SuperBlockReader::blockSize() const
+{
+    return blockSize_;
+}
+
+size_t SuperBlockReader::numBlocks() const
+{
+    return (size_t) numBlocks_.area();
+}
+
+size_t SuperBlockReader::pending() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return assemblies_.size();
+}
+
+cv::Rect SuperBlockReader::superBlockRect(int col, int row) const
+{
+    return cv::Rect(col * blockSize_.width, row * blockSize_.height, blockSize_.width, blockSize_.height) &
+           cv::Rect({ 0, 0 }, imageSize_);
+}
+
+size_t SuperBlockReader::nativeBlocksIn(const cv::Rect& rect) const
+{
+    auto cols = (rect.br().x - 1) / nativeBlockSize_.width - rect.x / nativeBlockSize_.width + 1;
+    auto rows = (rect.br().y - 1) / nativeBlockSize_.height - rect.y / nativeBlockSize_.height + 1;
+    return (size_t) cols * rows;
+}
+
+} } // namespace dg { namespace osn {
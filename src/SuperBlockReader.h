@@ -0,0 +1,83 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_SUPERBLOCKREADER_H
+#define OPENSPACENET_SUPERBLOCKREADER_H
+
+#include "BlockBufferPool.h"
+#include <functional>
+#include <map>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <utility>
+#include <vector>
+
+namespace dg { namespace osn {
+
+//
+// Re-blocks an image read in native blocks into super-blocks aligned to the window size. Native blocks may arrive
+// in any order and from several threads. Their pixels are copied into every super-block they overlap, and a
+// super-block is passed on as soon as its last native block has arrived, so only partially assembled super-blocks
+// are held in memory.
+//
+class SuperBlockReader
+{
+public:
+    // Same contract as GeoImage read functions, returns false to stop reading
+    typedef std::function<bool(const cv::Point& origin, cv::Mat&& block)> BlockFunc;
+
+    // Super-blocks are allocated from pool, if there is one
+    SuperBlockReader(const cv::Size& imageSize, const cv::Size& nativeBlockSize, const cv::Size& windowSize,
+                     BlockFunc func, const BlockBufferPool* pool = nullptr);
+
+    // Smallest multiple of the window size that covers a native block, capped so that striped images still make
+    // reasonably small super-blocks
+    static cv::Size superBlockSize(const cv::Size& nativeBlockSize, const cv::Size& windowSize);
+
+    bool add(const cv::Point& origin, cv::Mat&& block);
+
+    const cv::Size& blockSize() const;
+    size_t numBlocks() const;
+
+    // Super-blocks started but still missing native blocks
+    size_t pending() const;
+
+private:
+    typedef std::pair<int, int> Key;
+
+    struct Assembly
+    {
+        cv::Mat block;
+        size_t remaining;
+    };
+
+    cv::Rect superBlockRect(int col, int row) const;
+    size_t nativeBlocksIn(const cv::Rect& rect) const;
+
+    const cv::Size imageSize_;
+    const cv::Size nativeBlockSize_;
+    const cv::Size blockSize_;
+    const cv::Size numBlocks_;
+    BlockFunc func_;
+    const BlockBufferPool* pool_;
+
+    mutable std::mutex mutex_;
+    std::map<Key, Assembly> assemblies_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_SUPERBLOCKREADER_H
@@ -0,0 +1,161 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "TileCache.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <cmath>
+#include <fstream>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <utility/Logging.h>
+
+namespace dg { namespace osn {
+
+using boost::filesystem::absolute;
+using boost::filesystem::create_directories;
+using boost::filesystem::exists;
+using boost::filesystem::file_size;
+using boost::filesystem::path;
+using boost::format;
+using std::ifstream;
+using std::ofstream;
+using std::string;
+using std::vector;
+
+static const double WEB_MERCATOR_HALF_EXTENT = 20037508.342789244;
+
+// The last bytes of complete files, the IEND chunk of a PNG and the EOI marker of a JPEG
+static const string PNG_TRAILER("IEND\xAE\x42\x60\x82", 8);
+static const string JPEG_TRAILER("\xFF\xD9", 2);
+
+TileCache::TileCache(const string& cachePath, int zoom, const string& extension) :
+    path_(absolute(path(cachePath)).string()),
+    zoom_(zoom),
+    extension_(extension)
+{
+    create_directories(path_);
+}
+
+cv::Point TileCache::tileAt(const cv::Point2d& projPoint) const
+{
+    double tileSpan = 2 * WEB_MERCATOR_HALF_EXTENT / (1 << zoom_);
+    return {
+        (int) std::floor((projPoint.x + WEB_MERCATOR_HALF_EXTENT) / tileSpan),
+        (int) std::floor((WEB_MERCATOR_HALF_EXTENT - projPoint.y) / tileSpan)
+    };
+}
+
+string TileCache::tilePath(const cv::Point& tile) const
+{
+    return (format("%s/%d/%d/%d.%s") % path_ % zoom_ % tile.x % tile.y % extension_).str();
+}
+
+bool TileCache::hasTile(const cv::Point& tile) const
+{
+    // Tiles are renamed into place once written, but a crash can still leave an empty or truncated file behind
+    // once the file system recovers
+    auto tilePath = this->tilePath(tile);
+    const auto& trailer = extension_ == "png" ? PNG_TRAILER : JPEG_TRAILER;
+    if(!exists(tilePath) || file_size(tilePath) <= trailer.size()) {
+        return false;
+    }
+
+    ifstream ifs(tilePath, std::ios::binary);
+    ifs.seekg(-(std::streamoff) trailer.size(), std::ios::end);
+    string end(trailer.size(), '\0');
+    ifs.read(&end[0], end.size());
+    return ifs && end == trailer;
+}
+
+void TileCache::writeTile(const cv::Point& tile, const cv::Mat& image) const
+{
+    path tilePath(this->tilePath(tile));
+    create_directories(tilePath.parent_path());
+
+    // imwrite takes BGR, GDAL reads the tiles back in band order
+    cv::Mat bgr;
+    if(image.channels() == 3) {
+        cv::cvtColor(image, bgr, cv::COLOR_RGB2BGR);
+    } else if(image.channels() == 4) {
+        cv::cvtColor(image, bgr, cv::COLOR_RGBA2BGRA);
+    } else {
+        bgr = image;
+    }
+
+    auto tmpPath = tilePath.string() + ".tmp.png";
+    DG_CHECK(cv::imwrite(tmpPath, bgr), "Error writing tile %s", tmpPath.c_str());
+    commit(tmpPath, tilePath.string());
+}
+
+void TileCache::writeTile(const cv::Point& tile, const vector<uchar>& data) const
+{
+    path tilePath(this->tilePath(tile));
+    create_directories(tilePath.parent_path());
+
+    auto tmpPath = tilePath.string() + ".tmp";
+    {
+        ofstream ofs(tmpPath, std::ios::binary);
+        ofs.write(reinterpret_cast<const char*>(data.data()), data.size());
+        DG_CHECK(ofs.good(), "Error writing tile %s", tmpPath.c_str());
+    }
+    commit(tmpPath, tilePath.string());
+}
+
+void TileCache::commit(const string& tmpPath, const string& tilePath) const
+{
+    // Tiles are written to a temporary file first, so an interrupted run never leaves a partial tile behind
+    boost::filesystem::rename(tmpPath, tilePath);
+}
+
+void TileCache::writeDescription(const cv::Size& tileSize, int bands) const
+{
+    ofstream ofs(descriptionPath());
+    DG_CHECK(!ofs.fail(), "Error opening %s for writing.", descriptionPath().c_str());
+
+    ofs << format(
+        "<GDAL_WMS>\n"
+        "    <Service name=\"TMS\">\n"
+        "        <ServerUrl>file://%1%/${z}/${x}/${y}.%8%</ServerUrl>\n"
+        "    </Service>\n"
+        "    <DataWindow>\n"
+        "        <UpperLeftX>%2$.9f</UpperLeftX>\n"
+        "        <UpperLeftY>%3$.9f</UpperLeftY>\n"
+        "        <LowerRightX>%3$.9f</LowerRightX>\n"
+        "        <LowerRightY>%2$.9f</LowerRightY>\n"
+        "        <TileLevel>%4%</TileLevel>\n"
+        "        <TileCountX>1</TileCountX>\n"
+        "        <TileCountY>1</TileCountY>\n"
+        "        <YOrigin>top</YOrigin>\n"
+        "    </DataWindow>\n"
+        "    <Projection>EPSG:3857</Projection>\n"
+        "    <BlockSizeX>%5%</BlockSizeX>\n"
+        "    <BlockSizeY>%6%</BlockSizeY>\n"
+        "    <BandsCount>%7%</BandsCount>\n"
+        "    <ZeroBlockHttpCodes>404</ZeroBlockHttpCodes>\n"
+        "    <ZeroBlockOnServerException>true</ZeroBlockOnServerException>\n"
+        "</GDAL_WMS>\n")
+        % path_ % -WEB_MERCATOR_HALF_EXTENT % WEB_MERCATOR_HALF_EXTENT % zoom_
+        % tileSize.width % tileSize.height % bands % extension_;
+}
+
+string TileCache::descriptionPath() const
+{
+    return path_ + "/tiles.xml";
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,61 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_TILECACHE_H
+#define OPENSPACENET_TILECACHE_H
+
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+namespace dg { namespace osn {
+
+//
+// A local z/x/y cache of web mercator map service tiles. The cache directory also gets a GDAL WMS
+// description (tiles.xml), so the staged tiles can be used as a local image with the --image option.
+//
+// Tiles are stored either as the service's encoded responses, with a "jpg" extension, or as decoded images
+// re-encoded losslessly, with a "png" extension.
+//
+class TileCache
+{
+public:
+    TileCache(const std::string& path, int zoom, const std::string& extension = "png");
+
+    // Returns the tile containing the given EPSG:3857 point
+    cv::Point tileAt(const cv::Point2d& projPoint) const;
+
+    std::string tilePath(const cv::Point& tile) const;
+    // Whether the tile is there and complete
+    bool hasTile(const cv::Point& tile) const;
+
+    // Writes an RGB(A) image as PNG, or the encoded data as it is
+    void writeTile(const cv::Point& tile, const cv::Mat& image) const;
+    void writeTile(const cv::Point& tile, const std::vector<uchar>& data) const;
+    void writeDescription(const cv::Size& tileSize, int bands) const;
+    std::string descriptionPath() const;
+
+private:
+    void commit(const std::string& tmpPath, const std::string& tilePath) const;
+
+    std::string path_;
+    int zoom_;
+    std::string extension_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_TILECACHE_H
@@ -0,0 +1,281 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "TiledPyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using dg::deepcore::imagery::SizeSteps;
+using std::max;
+using std::min;
+
+// Number of windows of the given size and step that fit in length
+static int windowCount(int length, int window, int step)
+{
+    return length >= window ? (length - window) / step + 1 : 0;
+}
+
+// First and last window index starting in [begin, end)
+static void windowRange(int begin, int end, int step, int count, int& first, int& last)
+{
+    first = (begin + step - 1) / step;
+    last = min(count - 1, (end - 1) / step);
+}
+
+TiledPyramid::TiledPyramid(const cv::Size& aoiSize, const cv::Size& windowSize, const SizeSteps& levels,
+                           int tileSize) :
+    aoiSize_(aoiSize),
+    windowSize_(windowSize),
+    tileSize_(tileSize)
+{
+    DG_CHECK(tileSize_ > 0, "Invalid pyramid tile size: %d", tileSize_);
+
+    cv::Size originSpan;
+    for(const auto& sizeStep : levels) {
+        Level level;
+        level.window = sizeStep.first;
+        level.step = sizeStep.second;
+        DG_CHECK(level.step.x > 0 && level.step.y > 0, "Invalid pyramid step size");
+
+        level.scale = { (double) level.window.width / windowSize_.width,
+                        (double) level.window.height / windowSize_.height };
+        level.count = { windowCount(aoiSize_.width, level.window.width, level.step.x),
+                        windowCount(aoiSize_.height, level.window.height, level.step.y) };
+        if(!level.count.area()) {
+            continue;
+        }
+
+        // Windows larger than a tile would make the halo of every tile span them, these come from the mosaic
+        if(level.window.width > tileSize_ || level.window.height > tileSize_) {
+            coarseLevels_.push_back(level);
+            continue;
+        }
+
+        halo_.width = max(halo_.width, level.window.width);
+        halo_.height = max(halo_.height, level.window.height);
+        originSpan.width = max(originSpan.width, (level.count.width - 1) * level.step.x + 1);
+        originSpan.height = max(originSpan.height, (level.count.height - 1) * level.step.y + 1);
+        levels_.push_back(level);
+    }
+
+    // Each level is built from the previous one, so go from fine to coarse
+    auto finer = [](const Level& a, const Level& b) {
+        return a.scale.x < b.scale.x;
+    };
+    std::stable_sort(levels_.begin(), levels_.end(), finer);
+    std::stable_sort(coarseLevels_.begin(), coarseLevels_.end(), finer);
+
+    // The mosaic needs every pixel of the AOI
+    if(!coarseLevels_.empty()) {
+        originSpan = aoiSize_;
+    }
+
+    tiles_ = { (originSpan.width + tileSize_ - 1) / tileSize_, (originSpan.height + tileSize_ - 1) / tileSize_ };
+}
+
+size_t TiledPyramid::numTiles() const
+{
+    return (size_t) tiles_.area();
+}
+
+size_t TiledPyramid::totalWindows() const
+{
+    size_t total = 0;
+    for(const auto& level : levels_) {
+        total += (size_t) level.count.area();
+    }
+    for(const auto& level : coarseLevels_) {
+        total += (size_t) level.count.area();
+    }
+    return total;
+}
+
+cv::Rect TiledPyramid::tileExtent(size_t tile) const
+{
+    cv::Point origin((int) (tile % tiles_.width) * tileSize_, (int) (tile / tiles_.width) * tileSize_);
+    return { origin.x, origin.y,
+             min(tileSize_ + halo_.width, aoiSize_.width - origin.x),
+             min(tileSize_ + halo_.height, aoiSize_.height - origin.y) };
+}
+
+int TiledPyramid::readScale() const
+{
+    if(levels_.empty() && coarseLevels_.empty()) {
+        return 1;
+    }
+
+    auto finest = std::numeric_limits<double>::max();
+    for(const auto& level : levels_) {
+        finest = min(finest, min(level.scale.x, level.scale.y));
+    }
+    for(const auto& level : coarseLevels_) {
+        finest = min(finest, min(level.scale.x, level.scale.y));
+    }
+
+    for(int scale = 8; scale > 1; scale /= 2) {
+        if(finest >= scale) {
+            return scale;
+        }
+    }
+    return 1;
+}
+
+bool TiledPyramid::slice(size_t tile, const cv::Mat& image, const WindowFunc& func)
+{
+    auto extent = tileExtent(tile);
+    int inputScale = 1;
+    if(image.size() != extent.size()) {
+        inputScale = readScale();
+        cv::Size reduced((extent.width + inputScale - 1) / inputScale, (extent.height + inputScale - 1) / inputScale);
+        DG_CHECK(inputScale > 1 && image.size() == reduced, "Pyramid tile doesn't match its extent");
+    }
+
+    addToMosaic(extent, image, inputScale);
+
+    cv::Rect origins(extent.x, extent.y, min(tileSize_, extent.width), min(tileSize_, extent.height));
+    cv::Mat previous = image;
+    cv::Point2d previousScale(inputScale, inputScale);
+    for(const auto& level : levels_) {
+        cv::Mat levelImage;
+        if(level.scale == previousScale) {
+            levelImage = previous;
+        } else {
+            cv::Size size(max(1, (int) std::round(extent.width / level.scale.x)),
+                          max(1, (int) std::round(extent.height / level.scale.y)));
+            auto interpolation = size.width < previous.cols ? cv::INTER_AREA : cv::INTER_LINEAR;
+            cv::resize(previous, levelImage, size, 0, 0, interpolation);
+        }
+
+        if(!sliceLevel(level, levelImage, extent, origins, func)) {
+            return false;
+        }
+
+        previous = levelImage;
+        previousScale = level.scale;
+    }
+
+    return true;
+}
+
+bool TiledPyramid::sliceCoarse(const WindowFunc& func) const
+{
+    if(coarseLevels_.empty()) {
+        return true;
+    }
+
+    DG_CHECK(!mosaic_.empty(), "Pyramid mosaic wasn't built");
+
+    cv::Rect aoi({ 0, 0 }, aoiSize_);
+    cv::Mat previous = mosaic_;
+    auto previousScale = mosaicScale();
+    for(const auto& level : coarseLevels_) {
+        cv::Mat levelImage;
+        if(level.scale == previousScale) {
+            levelImage = previous;
+        } else {
+            cv::Size size(max(1, (int) std::round(aoiSize_.width / level.scale.x)),
+                          max(1, (int) std::round(aoiSize_.height / level.scale.y)));
+            cv::resize(previous, levelImage, size, 0, 0, cv::INTER_AREA);
+        }
+
+        if(!sliceLevel(level, levelImage, aoi, aoi, func)) {
+            return false;
+        }
+
+        previous = levelImage;
+        previousScale = level.scale;
+    }
+
+    return true;
+}
+
+const cv::Mat& TiledPyramid::mosaic() const
+{
+    return mosaic_;
+}
+
+cv::Point2d TiledPyramid::mosaicScale() const
+{
+    return coarseLevels_.empty() ? cv::Point2d(1, 1) : coarseLevels_.front().scale;
+}
+
+bool TiledPyramid::sliceLevel(const Level& level, const cv::Mat& levelImage, const cv::Rect& extent,
+                              const cv::Rect& origins, const WindowFunc& func) const
+{
+    if(levelImage.cols < windowSize_.width || levelImage.rows < windowSize_.height) {
+        return true;
+    }
+
+    int col0, col1, row0, row1;
+    windowRange(origins.x, origins.x + origins.width, level.step.x, level.count.width, col0, col1);
+    windowRange(origins.y, origins.y + origins.height, level.step.y, level.count.height, row0, row1);
+
+    for(int row = row0; row <= row1; ++row) {
+        for(int col = col0; col <= col1; ++col) {
+            cv::Rect window(col * level.step.x, row * level.step.y, level.window.width, level.window.height);
+
+            // Rounding may put the last window a pixel past the level image, keep it inside
+            cv::Point local((int) std::round((window.x - extent.x) / level.scale.x),
+                            (int) std::round((window.y - extent.y) / level.scale.y));
+            local.x = max(0, min(local.x, levelImage.cols - windowSize_.width));
+            local.y = max(0, min(local.y, levelImage.rows - windowSize_.height));
+
+            if(!func(window, levelImage(cv::Rect(local, windowSize_)))) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void TiledPyramid::addToMosaic(const cv::Rect& extent, const cv::Mat& image, int inputScale)
+{
+    if(coarseLevels_.empty()) {
+        return;
+    }
+
+    auto scale = mosaicScale();
+    if(mosaic_.empty()) {
+        cv::Size size(max(1, (int) std::round(aoiSize_.width / scale.x)),
+                      max(1, (int) std::round(aoiSize_.height / scale.y)));
+        mosaic_ = cv::Mat::zeros(size, image.type());
+    }
+
+    // Only the tile itself, the halo belongs to the next tiles. Neighbouring tiles round their shared edge the same
+    // way, so the mosaic is covered without gaps.
+    auto right = min(extent.x + tileSize_, aoiSize_.width);
+    auto bottom = min(extent.y + tileSize_, aoiSize_.height);
+    cv::Point tl((int) std::round(extent.x / scale.x), (int) std::round(extent.y / scale.y));
+    cv::Point br(min(mosaic_.cols, (int) std::round(right / scale.x)),
+                 min(mosaic_.rows, (int) std::round(bottom / scale.y)));
+    if(br.x <= tl.x || br.y <= tl.y) {
+        return;
+    }
+
+    cv::Size core(max(1, min(image.cols, (int) std::round((double) (right - extent.x) / inputScale))),
+                  max(1, min(image.rows, (int) std::round((double) (bottom - extent.y) / inputScale))));
+    cv::Mat target = mosaic_(cv::Rect(tl, br));
+    cv::resize(image(cv::Rect({ 0, 0 }, core)), target, target.size(), 0, 0, cv::INTER_AREA);
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,99 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_TILEDPYRAMID_H
+#define OPENSPACENET_TILEDPYRAMID_H
+
+#include <functional>
+#include <imagery/SlidingWindow.h>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+namespace dg { namespace osn {
+
+//
+// Sliding windows of several pyramid levels over an AOI, produced one tile at a time. Each tile is read with a right
+// and bottom halo wide enough for every window starting in it, downsampled once per level from the previous level,
+// and cut into windows of the model size. A window belongs to the tile its top left corner falls in, so every
+// window is produced exactly once.
+//
+// Only the levels whose windows fit in a tile are sliced per tile, so the halo is at most one tile. The coarser
+// levels would need a halo spanning most of the AOI. Instead, the core of every tile is downsampled into a mosaic at
+// the scale of the first coarse level, and those levels are sliced from it once all tiles are done, each one
+// downsampled from the previous. The mosaic holds the AOI reduced by more than tile / model window per side.
+//
+class TiledPyramid
+{
+public:
+    // Called for each window with its rectangle in AOI pixels and its image at the model window size, returns false
+    // to stop slicing
+    typedef std::function<bool(const cv::Rect& window, const cv::Mat& image)> WindowFunc;
+
+    // Level window sizes and steps are in AOI pixels, as returned by SlidingWindow::calcSizes(). Windows are resized
+    // to windowSize.
+    TiledPyramid(const cv::Size& aoiSize, const cv::Size& windowSize, const deepcore::imagery::SizeSteps& levels,
+                 int tileSize);
+
+    size_t numTiles() const;
+    size_t totalWindows() const;
+
+    // The AOI region to read for a tile
+    cv::Rect tileExtent(size_t tile) const;
+
+    // The largest of 2, 4 and 8 that every level is downsampled by, or 1. No level needs finer pixels than that, so
+    // tiles may be read reduced by this much.
+    int readScale() const;
+
+    // Slices a tile read from tileExtent(), either at full resolution or reduced by readScale() with the size rounded
+    // up, and adds it to the mosaic. Returns false if func stopped it.
+    bool slice(size_t tile, const cv::Mat& image, const WindowFunc& func);
+
+    // Slices the coarse levels once every tile has been sliced. Returns false if func stopped it.
+    bool sliceCoarse(const WindowFunc& func) const;
+
+    // The AOI downsampled for the coarse levels, empty if there are none
+    const cv::Mat& mosaic() const;
+
+    // The downsampling factor of mosaic()
+    cv::Point2d mosaicScale() const;
+
+private:
+    struct Level
+    {
+        cv::Size window;
+        cv::Point step;
+        cv::Point2d scale;
+        cv::Size count;
+    };
+
+    // Cuts the windows of level starting in origins out of levelImage, which covers extent of the AOI
+    bool sliceLevel(const Level& level, const cv::Mat& levelImage, const cv::Rect& extent, const cv::Rect& origins,
+                    const WindowFunc& func) const;
+    void addToMosaic(const cv::Rect& extent, const cv::Mat& image, int inputScale);
+
+    const cv::Size aoiSize_;
+    const cv::Size windowSize_;
+    const int tileSize_;
+    std::vector<Level> levels_;
+    std::vector<Level> coarseLevels_;
+    cv::Size halo_;
+    cv::Size tiles_;
+    cv::Mat mosaic_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_TILEDPYRAMID_H
@@ -0,0 +1,127 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "VectorTileWriter.h"
+
+#include <boost/lexical_cast.hpp>
+#include <cpl_string.h>
+#include <ogr_srs_api.h>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using boost::lexical_cast;
+using std::string;
+using std::vector;
+
+static void addField(OGRLayerH layer, const char* name, OGRFieldType type)
+{
+    auto field = OGR_Fld_Create(name, type);
+    auto err = OGR_L_CreateField(layer, field, TRUE);
+    OGR_Fld_Destroy(field);
+    DG_CHECK(err == OGRERR_NONE, "Error creating the %s field", name);
+}
+
+VectorTileWriter::VectorTileWriter(const string& path, const string& layerName, const string& srs,
+                                   int minZoom, int maxZoom, bool points, bool withSource) :
+    points_(points),
+    withSource_(withSource)
+{
+    GDALAllRegister();
+    auto driver = GDALGetDriverByName("MBTiles");
+    DG_CHECK(driver && GDALGetMetadataItem(driver, GDAL_DCAP_VECTOR, nullptr),
+             "This GDAL version can't write vector MBTiles, it requires GDAL 2.3 or later");
+
+    auto sr = OSRNewSpatialReference(nullptr);
+    if(OSRSetFromUserInput(sr, srs.c_str()) != OGRERR_NONE) {
+        OSRDestroySpatialReference(sr);
+        DG_ERROR_THROW("Invalid output spatial reference for MBTiles");
+    }
+#if GDAL_VERSION_NUM >= 3000000
+    OSRSetAxisMappingStrategy(sr, OAMS_TRADITIONAL_GIS_ORDER);
+#endif
+
+    char** options = nullptr;
+    options = CSLSetNameValue(options, "NAME", layerName.c_str());
+    options = CSLSetNameValue(options, "TYPE", "overlay");
+    options = CSLSetNameValue(options, "MINZOOM", lexical_cast<string>(minZoom).c_str());
+    options = CSLSetNameValue(options, "MAXZOOM", lexical_cast<string>(maxZoom).c_str());
+    dataset_ = GDALCreate(driver, path.c_str(), 0, 0, 0, GDT_Unknown, options);
+    CSLDestroy(options);
+    if(!dataset_) {
+        OSRDestroySpatialReference(sr);
+        DG_ERROR_THROW("Error creating %s", path.c_str());
+    }
+
+    layer_ = GDALDatasetCreateLayer(dataset_, layerName.c_str(), sr, points ? wkbPoint : wkbPolygon, nullptr);
+    OSRDestroySpatialReference(sr);
+    if(!layer_) {
+        close();
+        DG_ERROR_THROW("Error creating the %s layer", layerName.c_str());
+    }
+
+    addField(layer_, "top_cat", OFTString);
+    addField(layer_, "top_score", OFTReal);
+    if(withSource) {
+        addField(layer_, "source", OFTString);
+    }
+}
+
+VectorTileWriter::~VectorTileWriter()
+{
+    close();
+}
+
+void VectorTileWriter::addFeature(const vector<cv::Point2d>& points, const string& topCat, double topScore,
+                                  const string& source)
+{
+    OGRGeometryH geometry;
+    if(points_) {
+        geometry = OGR_G_CreateGeometry(wkbPoint);
+        OGR_G_SetPoint_2D(geometry, 0, points.front().x, points.front().y);
+    } else {
+        auto ring = OGR_G_CreateGeometry(wkbLinearRing);
+        for(const auto& point : points) {
+            OGR_G_AddPoint_2D(ring, point.x, point.y);
+        }
+        geometry = OGR_G_CreateGeometry(wkbPolygon);
+        OGR_G_AddGeometryDirectly(geometry, ring);
+    }
+
+    // The fields are in the order they were created
+    auto feature = OGR_F_Create(OGR_L_GetLayerDefn(layer_));
+    OGR_F_SetGeometryDirectly(feature, geometry);
+    OGR_F_SetFieldString(feature, 0, topCat.c_str());
+    OGR_F_SetFieldDouble(feature, 1, topScore);
+    if(withSource_) {
+        OGR_F_SetFieldString(feature, 2, source.c_str());
+    }
+
+    auto err = OGR_L_CreateFeature(layer_, feature);
+    OGR_F_Destroy(feature);
+    DG_CHECK(err == OGRERR_NONE, "Error writing a vector tile feature");
+}
+
+void VectorTileWriter::close()
+{
+    if(dataset_) {
+        GDALClose(dataset_);
+        dataset_ = nullptr;
+        layer_ = nullptr;
+    }
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,61 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_VECTORTILEWRITER_H
+#define OPENSPACENET_VECTORTILEWRITER_H
+
+#include <gdal.h>
+#include <opencv2/core/core.hpp>
+#include <ogr_api.h>
+#include <string>
+#include <vector>
+
+namespace dg { namespace osn {
+
+//
+// Writes detections as Mapbox Vector Tiles into an MBTiles file, through the GDAL MBTiles driver. Each feature is
+// clipped into its tiles at every zoom level as it is added, and the tiles are encoded when the writer is closed.
+// Tiles over the driver's size and feature count limits at the lower zoom levels are thinned out, so they stay
+// light enough to display.
+//
+// The features carry the top class and score, and the source image when there are several. The full schema of
+// the other output formats would make the tiles much larger.
+//
+class VectorTileWriter
+{
+public:
+    // srs is anything OGR understands, i.e. "EPSG:4326" or WKT, with longitude, or easting, first
+    VectorTileWriter(const std::string& path, const std::string& layerName, const std::string& srs,
+                     int minZoom, int maxZoom, bool points, bool withSource);
+    ~VectorTileWriter();
+
+    // The ring for polygons, a single point for points
+    void addFeature(const std::vector<cv::Point2d>& points, const std::string& topCat, double topScore,
+                    const std::string& source = "");
+
+    // Encodes the tiles, which is most of the work
+    void close();
+
+private:
+    GDALDatasetH dataset_ = nullptr;
+    OGRLayerH layer_ = nullptr;
+    bool points_;
+    bool withSource_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_VECTORTILEWRITER_H
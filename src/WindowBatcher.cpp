@@ -0,0 +1,59 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "WindowBatcher.h"
+
+namespace dg { namespace osn {
+
+using dg::deepcore::imagery::Subset;
+
+WindowBatcher::WindowBatcher(BoundedQueue<WindowBatch>& batches, size_t batchSize, bool skipFeatureless) :
+    batches_(batches),
+    batchSize_(batchSize),
+    skipFeatureless_(skipFeatureless)
+{
+}
+
+bool WindowBatcher::add(const Subset& subset, bool featureless)
+{
+    if(featureless) {
+        ++batch_.featureless;
+        if(skipFeatureless_) {
+            return true;
+        }
+        batch_.featurelessKept.push_back(subset.rect);
+    }
+
+    batch_.subsets.push_back(subset);
+    if(batch_.subsets.size() >= batchSize_) {
+        return flush();
+    }
+
+    return true;
+}
+
+bool WindowBatcher::flush()
+{
+    if(batch_.subsets.empty() && !batch_.featureless) {
+        return true;
+    }
+
+    auto pushed = batches_.push(std::move(batch_));
+    batch_ = WindowBatch();
+    return pushed;
+}
+
+} } // namespace dg { namespace osn {
@@ -0,0 +1,58 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_WINDOWBATCHER_H
+#define OPENSPACENET_WINDOWBATCHER_H
+
+#include "BoundedQueue.h"
+#include <imagery/SlidingWindow.h>
+#include <opencv2/core/types.hpp>
+#include <vector>
+
+namespace dg { namespace osn {
+
+struct WindowBatch
+{
+    deepcore::imagery::Subsets subsets;
+    // Windows below the saliency threshold, left out of subsets unless calibrating
+    size_t featureless = 0;
+    // Featureless windows classified anyway when calibrating
+    std::vector<cv::Rect> featurelessKept;
+};
+
+//
+// Groups windows into batches of the model's batch size and hands them to the model through a queue. Featureless
+// windows are counted and, unless calibrating, left out, so they don't thin out the batches.
+//
+class WindowBatcher
+{
+public:
+    WindowBatcher(BoundedQueue<WindowBatch>& batches, size_t batchSize, bool skipFeatureless);
+
+    // Returns false once the queue is closed
+    bool add(const deepcore::imagery::Subset& subset, bool featureless);
+    bool flush();
+
+private:
+    BoundedQueue<WindowBatch>& batches_;
+    const size_t batchSize_;
+    const bool skipFeatureless_;
+    WindowBatch batch_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_WINDOWBATCHER_H
@@ -0,0 +1,482 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#include "WmsReader.h"
+#include "OpenSpaceNetLog.h"
+
+#include <algorithm>
+#include <boost/format.hpp>
+#include <curl/curl.h>
+#include <future>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <utility/Error.h>
+
+namespace dg { namespace osn {
+
+using boost::format;
+using dg::deepcore::geometry::Transformation;
+using std::async;
+using std::atomic;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::future;
+using std::launch;
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+using std::string;
+using std::vector;
+
+// Requests are never smaller than this, rounded up to the block size
+static const int MIN_REQUEST_SIZE = 512;
+
+// Requests faster than this grow, slower ones shrink
+static const duration<double> FAST_REQUEST(2.0);
+static const duration<double> SLOW_REQUEST(8.0);
+
+// A request is tried this many times before giving up
+static const int MAX_ATTEMPTS = 3;
+
+static const long REQUEST_TIMEOUT = 120;
+
+static int roundUp(int value, int multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// Size of an image decoded at 1/scale, JPEG scaled decoding rounds up
+static cv::Size reducedSize(const cv::Size& size, int scale)
+{
+    return { (size.width + scale - 1) / scale, (size.height + scale - 1) / scale };
+}
+
+static int decodeFlags(int scale)
+{
+    switch(scale) {
+        case 2:
+            return cv::IMREAD_REDUCED_COLOR_2;
+        case 4:
+            return cv::IMREAD_REDUCED_COLOR_4;
+        case 8:
+            return cv::IMREAD_REDUCED_COLOR_8;
+        default:
+            return cv::IMREAD_COLOR;
+    }
+}
+
+static size_t onData(char* data, size_t size, size_t count, void* userData)
+{
+    auto buffer = static_cast<vector<uchar>*>(userData);
+    buffer->insert(buffer->end(), data, data + size * count);
+    return size * count;
+}
+
+WmsReader::WmsReader(const string& url, const string& layer, const string& token, const string& credentials,
+                     const Transformation& pixelToProj, const cv::Size& imageSize, const cv::Size& blockSize,
+                     int maxConnections, int maxRequestSize, RateLimiter* limiter) :
+    url_(url),
+    layer_(layer),
+    token_(token),
+    credentials_(credentials),
+    pixelToProj_(pixelToProj),
+    imageRect_({ 0, 0 }, imageSize),
+    blockSize_(blockSize),
+    maxConnections_(max(1, maxConnections)),
+    minRequestSize_(roundUp(MIN_REQUEST_SIZE, max(blockSize.width, blockSize.height))),
+    maxRequestSize_(max(minRequestSize_, roundUp(maxRequestSize, max(blockSize.width, blockSize.height)))),
+    limiter_(limiter),
+    requestSize_(maxRequestSize_),
+    requests_(0)
+{
+}
+
+WmsReader::~WmsReader()
+{
+    for(auto handle : handles_) {
+        curl_easy_cleanup(handle);
+    }
+}
+
+cv::Mat WmsReader::read(const cv::Rect& rect, const ProgressFunc& progress, int scale)
+{
+    DG_CHECK((rect & imageRect_) == rect, "Requested region is outside of the image");
+    DG_CHECK(scale == 1 || scale == 2 || scale == 4 || scale == 8, "Invalid decoding scale: %d", scale);
+
+    cv::Mat result;
+    mutex resultMutex;
+    size_t done = 0;
+    auto completed = readBands(rect, scale, [&](const cv::Rect& chunk, cv::Mat&& image) {
+        {
+            lock_guard<mutex> lock(resultMutex);
+            if(result.empty()) {
+                result.create(reducedSize(rect.size(), scale), image.type());
+            }
+        }
+
+        // Chunks don't overlap, so the copies can run unlocked. Reduced chunks start at multiples of the scale.
+        auto offset = chunk.tl() - rect.tl();
+        image.copyTo(result(cv::Rect(cv::Point(offset.x / scale, offset.y / scale), image.size())));
+
+        lock_guard<mutex> lock(resultMutex);
+        done += chunk.area();
+        return progress((float) done / rect.area());
+    });
+
+    DG_CHECK(completed, "Reading was cancelled");
+    return result;
+}
+
+void WmsReader::readBlocks(const BlockFunc& func, const BlockBufferPool* pool)
+{
+    readBands(imageRect_, 1, [this, &func, pool](const cv::Rect& chunk, cv::Mat&& image) {
+        // Chunks are aligned to the block grid, so every block comes from exactly one chunk
+        for(int y = chunk.y; y < chunk.br().y; y += blockSize_.height) {
+            for(int x = chunk.x; x < chunk.br().x; x += blockSize_.width) {
+                auto blockRect = cv::Rect(x, y, blockSize_.width, blockSize_.height) & chunk;
+                // A view would keep the whole chunk alive for as long as the block is queued
+                auto block = pool ? pool->newMat() : cv::Mat();
+                image(blockRect - chunk.tl()).copyTo(block);
+                if(!func(blockRect.tl(), std::move(block))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    });
+}
+
+void WmsReader::readEncodedBlocks(const EncodedBlockFunc& func)
+{
+    vector<cv::Rect> blocks;
+    for(int y = 0; y < imageRect_.height; y += blockSize_.height) {
+        for(int x = 0; x < imageRect_.width; x += blockSize_.width) {
+            blocks.push_back(cv::Rect(x, y, blockSize_.width, blockSize_.height) & imageRect_);
+        }
+    }
+
+    forEach(blocks.size(), [this, &blocks, &func](size_t i) {
+        const auto& block = blocks[i];
+        vector<uchar> data;
+        for(int attempt = 1;; ++attempt) {
+            try {
+                data = get(block);
+
+                // Service exceptions are XML, a JPEG starts with its SOI marker
+                DG_CHECK(data.size() > 2 && data[0] == 0xFF && data[1] == 0xD8, "WMS response is not an image");
+                break;
+            } catch(const std::exception& e) {
+                if(attempt == MAX_ATTEMPTS) {
+                    throw;
+                }
+                OSN_LOG(warning) << "WMS request for " << block << " failed, retrying: " << e.what();
+            }
+        }
+
+        return func(block.tl(), std::move(data));
+    });
+}
+
+void WmsReader::checkLayer()
+{
+    auto body = get(serviceUrl("SERVICE=WMS&REQUEST=GetCapabilities&VERSION=1.1.1"));
+    string capabilities(body.begin(), body.end());
+    DG_CHECK(capabilities.find("<Name>" + layer_ + "</Name>") != string::npos,
+             "The WMS service at %s doesn't offer the %s layer", url_.c_str(), layer_.c_str());
+}
+
+void WmsReader::warmUp()
+{
+    auto startTime = steady_clock::now();
+    auto url = serviceUrl("SERVICE=WMS&REQUEST=GetCapabilities");
+
+    vector<CURL*> handles;
+    for(int i = 0; i < maxConnections_; ++i) {
+        if(limiter_) {
+            limiter_->acquire();
+        }
+        handles.push_back(acquire());
+    }
+
+    // Header-only requests authenticate and leave a kept-alive connection in each handle
+    auto multi = curl_multi_init();
+    DG_CHECK(multi, "Unable to initialize WMS connections");
+    for(auto handle : handles) {
+        curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(handle, CURLOPT_TIMEOUT, REQUEST_TIMEOUT);
+        if(!credentials_.empty()) {
+            curl_easy_setopt(handle, CURLOPT_USERPWD, credentials_.c_str());
+        }
+        curl_multi_add_handle(multi, handle);
+    }
+
+    int running = 0;
+    do {
+        curl_multi_perform(multi, &running);
+        if(running) {
+            curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+        }
+    } while(running);
+
+    size_t failed = 0;
+    int remaining = 0;
+    while(auto message = curl_multi_info_read(multi, &remaining)) {
+        if(message->msg == CURLMSG_DONE && message->data.result != CURLE_OK) {
+            ++failed;
+        }
+    }
+
+    for(auto handle : handles) {
+        curl_multi_remove_handle(multi, handle);
+        release(handle);
+    }
+    curl_multi_cleanup(multi);
+
+    // A failed warm-up only costs the handshakes it was meant to save, the requests report real errors
+    duration<double> elapsed = steady_clock::now() - startTime;
+    OSN_LOG(debug) << "Warmed up " << handles.size() - failed << " of " << handles.size() << " WMS connections in "
+                   << elapsed.count() << " s";
+}
+
+int WmsReader::requestSize() const
+{
+    return requestSize_.load();
+}
+
+size_t WmsReader::requests() const
+{
+    return requests_.load();
+}
+
+bool WmsReader::readBands(const cv::Rect& area, int scale, const ChunkFunc& func)
+{
+    // Full resolution chunks are aligned to the image blocks. Reduced chunks are aligned to the area instead, with
+    // sides that are multiples of the scale, so each one lands on whole pixels of the reduced image.
+    cv::Point origin;
+    auto unit = blockSize_;
+    if(scale > 1) {
+        origin = area.tl();
+        unit = { roundUp(blockSize_.width, scale), roundUp(blockSize_.height, scale) };
+    }
+
+    // The request size is picked again for every band of chunks, so it follows the latency as the read progresses
+    for(int y = area.y; y < area.br().y;) {
+        auto size = requestSize_.load();
+        auto bottom = min(area.br().y, origin.y + (y - origin.y + size) / unit.height * unit.height);
+        if(bottom <= y) {
+            bottom = min(area.br().y, y + roundUp(size, unit.height));
+        }
+
+        vector<cv::Rect> chunks;
+        for(int x = area.x; x < area.br().x;) {
+            auto right = min(area.br().x, origin.x + (x - origin.x + size) / unit.width * unit.width);
+            if(right <= x) {
+                right = min(area.br().x, x + roundUp(size, unit.width));
+            }
+            chunks.emplace_back(x, y, right - x, bottom - y);
+            x = right;
+        }
+
+        if(!readChunks(chunks, scale, func)) {
+            return false;
+        }
+        y = bottom;
+    }
+
+    return true;
+}
+
+bool WmsReader::readChunks(const vector<cv::Rect>& chunks, int scale, const ChunkFunc& func)
+{
+    return forEach(chunks.size(), [this, &chunks, scale, &func](size_t i) {
+        return func(chunks[i], request(chunks[i], scale));
+    });
+}
+
+bool WmsReader::forEach(size_t count, const std::function<bool(size_t i)>& func)
+{
+    std::exception_ptr error;
+    mutex errorMutex;
+    atomic<size_t> next(0);
+    atomic<bool> stop(false);
+
+    auto worker = [&]() {
+        try {
+            size_t i;
+            while(!stop.load() && (i = next++) < count) {
+                if(!func(i)) {
+                    stop.store(true);
+                }
+            }
+        } catch(...) {
+            lock_guard<mutex> lock(errorMutex);
+            if(!error) {
+                error = std::current_exception();
+            }
+            stop.store(true);
+        }
+    };
+
+    vector<future<void>> workers;
+    auto numWorkers = min((size_t) maxConnections_, count);
+    for(size_t i = 1; i < numWorkers; ++i) {
+        workers.push_back(async(launch::async, worker));
+    }
+    worker();
+
+    for(auto& w : workers) {
+        w.wait();
+    }
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+
+    return !stop.load();
+}
+
+cv::Mat WmsReader::request(const cv::Rect& rect, int scale)
+{
+    for(int attempt = 1;; ++attempt) {
+        auto startTime = steady_clock::now();
+        try {
+            auto image = download(rect, scale);
+            adapt(steady_clock::now() - startTime, false);
+            return image;
+        } catch(const std::exception& e) {
+            adapt(steady_clock::now() - startTime, true);
+            if(attempt == MAX_ATTEMPTS) {
+                throw;
+            }
+            OSN_LOG(warning) << "WMS request for " << rect << " failed, retrying: " << e.what();
+        }
+    }
+}
+
+cv::Mat WmsReader::download(const cv::Rect& rect, int scale)
+{
+    // Service exceptions come back as XML with a 200 status, imdecode leaves those empty. Reduced JPEG decoding
+    // happens in the DCT domain, so the full resolution pixels are never produced.
+    auto image = cv::imdecode(get(rect), decodeFlags(scale));
+    DG_CHECK(!image.empty(), "WMS response is not an image");
+    DG_CHECK(image.size() == reducedSize(rect.size(), scale), "WMS response has an unexpected size");
+
+    // imdecode returns BGR, image blocks come in band order
+    cv::cvtColor(image, image, cv::COLOR_BGR2RGB);
+    return image;
+}
+
+vector<uchar> WmsReader::get(const cv::Rect& rect)
+{
+    auto tl = pixelToProj_.transform(cv::Point2d(rect.x, rect.y));
+    auto br = pixelToProj_.transform(cv::Point2d(rect.br().x, rect.br().y));
+
+    return get(serviceUrl((format("SERVICE=WMS&REQUEST=GetMap&VERSION=1.1.1&LAYERS=%1%&STYLES="
+                                  "&FORMAT=image/jpeg&SRS=EPSG:3857&BBOX=%2$.6f,%3$.6f,%4$.6f,%5$.6f"
+                                  "&WIDTH=%6%&HEIGHT=%7%")
+                           % layer_ % min(tl.x, br.x) % min(tl.y, br.y) % max(tl.x, br.x) % max(tl.y, br.y)
+                           % rect.width % rect.height).str()));
+}
+
+vector<uchar> WmsReader::get(const string& url)
+{
+    auto handle = acquire();
+    vector<uchar> body;
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, onData);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_TIMEOUT, REQUEST_TIMEOUT);
+    if(!credentials_.empty()) {
+        curl_easy_setopt(handle, CURLOPT_USERPWD, credentials_.c_str());
+    }
+
+    if(limiter_) {
+        limiter_->acquire();
+    }
+
+    auto result = curl_easy_perform(handle);
+    long status = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    release(handle);
+    ++requests_;
+
+    if(limiter_) {
+        limiter_->consume(body.size());
+    }
+
+    DG_CHECK(result == CURLE_OK, "WMS request failed: %s", curl_easy_strerror(result));
+    DG_CHECK(status == 200, "WMS request failed with HTTP status %ld", status);
+
+    return body;
+}
+
+string WmsReader::serviceUrl(const string& query) const
+{
+    auto url = url_ + (url_.find('?') == string::npos ? "?" : "&") + query;
+    if(!token_.empty()) {
+        url += "&CONNECTID=" + token_;
+    }
+    return url;
+}
+
+void WmsReader::adapt(duration<double> latency, bool failed)
+{
+    auto size = requestSize_.load();
+    auto step = max(blockSize_.width, blockSize_.height);
+    int adapted = size;
+    if(failed || latency > SLOW_REQUEST) {
+        adapted = max(minRequestSize_, roundUp(size / 2, step));
+    } else if(latency < FAST_REQUEST) {
+        adapted = min(maxRequestSize_, size * 2);
+    }
+
+    // Concurrent requests may adapt at the same time, only the first one to see the old size wins
+    if(adapted != size && requestSize_.compare_exchange_strong(size, adapted)) {
+        OSN_LOG(debug) << "WMS request size adapted to " << adapted << " pixels after a "
+                       << latency.count() << " s request";
+    }
+}
+
+CURL* WmsReader::acquire()
+{
+    {
+        lock_guard<mutex> lock(handleMutex_);
+        if(!handles_.empty()) {
+            auto handle = handles_.back();
+            handles_.pop_back();
+            return handle;
+        }
+    }
+
+    auto handle = curl_easy_init();
+    DG_CHECK(handle, "Unable to initialize a WMS request");
+    return handle;
+}
+
+void WmsReader::release(CURL* handle)
+{
+    // Handles are reused, so their connections stay open between requests
+    curl_easy_reset(handle);
+    lock_guard<mutex> lock(handleMutex_);
+    handles_.push_back(handle);
+}
+
+} } // namespace dg { namespace osn {
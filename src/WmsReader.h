@@ -0,0 +1,116 @@
+/********************************************************************************
+* Copyright 2017 DigitalGlobe, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+********************************************************************************/
+
+#ifndef OPENSPACENET_WMSREADER_H
+#define OPENSPACENET_WMSREADER_H
+
+#include "BlockBufferPool.h"
+#include "RateLimiter.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <geometry/Transformation.h>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <string>
+#include <vector>
+
+typedef void CURL;
+
+namespace dg { namespace osn {
+
+//
+// Reads areas of a web service image with WMS GetMap requests instead of one request per tile. Each request covers
+// up to requestSize() pixels square, adapted between a minimum and the configured maximum according to the observed
+// request latency, and up to maxConnections requests run at a time.
+//
+class WmsReader
+{
+public:
+    typedef std::function<bool(float progress)> ProgressFunc;
+    typedef std::function<bool(const cv::Point& origin, cv::Mat&& block)> BlockFunc;
+    typedef std::function<bool(const cv::Point& origin, std::vector<uchar>&& data)> EncodedBlockFunc;
+
+    // Requests read layer from the service at url. pixelToProj must outlive the reader, its projection is EPSG:3857.
+    // Every request passes through limiter, if there is one.
+    WmsReader(const std::string& url, const std::string& layer, const std::string& token,
+              const std::string& credentials, const deepcore::geometry::Transformation& pixelToProj,
+              const cv::Size& imageSize, const cv::Size& blockSize, int maxConnections, int maxRequestSize,
+              RateLimiter* limiter = nullptr);
+    ~WmsReader();
+
+    // Same contract as GeoImage::readImage(), throws if progress returns false. With a scale of 2, 4 or 8 the image
+    // is decoded at that reduced size, rounded up, instead of at full resolution.
+    cv::Mat read(const cv::Rect& rect, const ProgressFunc& progress, int scale = 1);
+
+    // Reads the whole image and splits it into blocks, calling func from several threads until it returns false. The
+    // blocks are copied into buffers from pool, if there is one.
+    void readBlocks(const BlockFunc& func, const BlockBufferPool* pool = nullptr);
+
+    // Requests every block on its own and passes on the JPEG responses undecoded, calling func from several threads
+    // until it returns false
+    void readEncodedBlocks(const EncodedBlockFunc& func);
+
+    // Throws if the service's capabilities don't list the layer
+    void checkLayer();
+
+    // Opens up to maxConnections connections at once, so the first requests don't pay for the handshakes
+    void warmUp();
+
+    // Current request size in pixels, and the number of requests made
+    int requestSize() const;
+    size_t requests() const;
+
+private:
+    typedef std::function<bool(const cv::Rect& rect, cv::Mat&& image)> ChunkFunc;
+
+    bool readBands(const cv::Rect& area, int scale, const ChunkFunc& func);
+    bool readChunks(const std::vector<cv::Rect>& chunks, int scale, const ChunkFunc& func);
+
+    // Calls func for 0 to count - 1 on up to maxConnections threads, until it returns false or throws
+    bool forEach(size_t count, const std::function<bool(size_t i)>& func);
+    cv::Mat request(const cv::Rect& rect, int scale);
+    cv::Mat download(const cv::Rect& rect, int scale);
+    std::vector<uchar> get(const cv::Rect& rect);
+    std::vector<uchar> get(const std::string& url);
+    std::string serviceUrl(const std::string& query) const;
+    void adapt(std::chrono::duration<double> latency, bool failed);
+
+    CURL* acquire();
+    void release(CURL* handle);
+
+    const std::string url_;
+    const std::string layer_;
+    const std::string token_;
+    const std::string credentials_;
+    const deepcore::geometry::Transformation& pixelToProj_;
+    const cv::Rect imageRect_;
+    const cv::Size blockSize_;
+    const int maxConnections_;
+    const int minRequestSize_;
+    const int maxRequestSize_;
+    RateLimiter* limiter_;
+
+    std::atomic<int> requestSize_;
+    std::atomic<size_t> requests_;
+
+    std::mutex handleMutex_;
+    std::vector<CURL*> handles_;
+};
+
+} } // namespace dg { namespace osn {
+
+#endif //OPENSPACENET_WMSREADER_H